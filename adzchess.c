@@ -1,18 +1,67 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if _PROFILE
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #ifndef _NOEDIT
-#define _NOEDIT (1)
+#define _NOEDIT (1) // Default input, see INPUTS; --fen and --pgn override it
+#endif
+#ifndef _CHESS960
+#define _CHESS960 (0)
+#endif
+#ifndef _WINDOW
+#if _ICCF
+#define _WINDOW (50) // Root window of the former ctpk.c build
+#else
+#define _WINDOW (20000)
+#endif
 #endif
 #define _ALLOW_CASTLE (1)
-#define _DEBUG (0)
+#ifndef _DEBUG
+#define _DEBUG (0) // Consistency checks of the incremental state in eval
+#endif
+#ifndef _STATS
+#define _STATS (0) // Search counters, printed per iteration in analysis mode
+#endif
+#if _STATS
+#define STAT(x) (x)
+#else
+#define STAT(x)
+#endif
+#ifndef _PROFILE
+#define _PROFILE (0) // Cycles per search phase, and misses from perf_event_open if 2
+#endif
+#if _PROFILE
+#define PROF(x) x
+#else
+#define PROF(x)
+#endif
 #define _GAME_LOST (800)
 #ifndef _MAXINDEX
 #define _MAXINDEX (200)
@@ -26,8 +75,6 @@
 #define _BRDFILE "start.brd"
 #define _FENFILE "start.fen"
 
-#define _ALPHA (-20000) // Adjusted as needed
-#define _BETA (20000)
 #define _OVERDEPTH (2)
 #define _S_DEPTH (4)
 #define _SORT
@@ -37,6 +84,68 @@
 #undef _CAND250
 #define _CANDCUT (200)
 #undef _Q0BLK // For opening phase, block Queen's moves at node root
+#ifndef _HASHBITS
+#define _HASHBITS (20) // 2^20 entries of 16 bytes
+#endif
+#define _HASHSAVEDEPTH (3) // Shallower entries are not worth a file
+#ifndef _EVALBITS
+#define _EVALBITS (16)
+#endif
+#ifndef _NNUE_MAXH
+#define _NNUE_MAXH (512) // Largest hidden layer a network file may ask for
+#endif
+#define _NNUE_INPUTS (768)
+#define _NNUEMAGIC (0x4e5a4441)
+#define _NNUEVERSION (1)
+#ifndef _SPSA_ITER
+#define _SPSA_ITER (200) // Iterations of the spsa mode
+#endif
+#define _SPSA_NODES (1000000) // Default node budget per self-play move
+#define _SPSA_PLIES (160) // Longer games are scored as draws
+#define _SPSA_RANDOM (4) // Random opening plies when no book is given
+#define _SPSA_RESIGN (1000) // Both sides agree on this margin for 4 moves: adjudicated
+#define _DATAGEN_NODES (4 << 20) // Default node budget per datagen position
+#define _DATAGEN_DEPTH (2) // Scores of shallower iterations are not sampled
+#define _DATAGEN_RANDOM (4) // Random opening plies of a datagen game without a book
+#define _DATAGEN_SKIP (8) // Plies of a game not sampled
+#define _DATAGEN_PLIES (400) // Longer datagen games are scored as draws
+#ifndef _TUNE_ITER
+#define _TUNE_ITER (1000) // Optimiser steps of the tune mode
+#endif
+#define _TUNE_MAXPARAMS (24)
+#define _TUNE_QPLY (8) // Capture depth used to find a quiet leaf
+#define _TUNE_RATE (1.0) // Adam step, in centipawns
+#define _TUNE_BLOCK (1 << 14) // Input lines read and quiesced at a time
+#ifndef _PAWNBITS
+#define _PAWNBITS (14)
+#endif
+#define _HASHMAGIC (0x485a4441)
+#define _HASHVERSION (1)
+#define _CKPTVERSION (2)
+#define _CKPTSECS (600) // Hash contents are saved this often between checkpoints
+#define _PONDER_K (3) // Opponent replies pre-analysed in ponder mode
+#define _MAXMULTIPV (16)
+#define _PGN_MAXPLIES (1024)
+#define _PGN_MAXTAGS (32)
+#define _PGNCHUNK (8 << 20) // Bytes of PGN a pgnfilter thread takes at a time
+#define _PGNF_MAXPOS (16)
+#define _SOCKFILE "adzchess.sock"
+#define _DBFILE "positions.db"
+#ifndef _BENCH_DEPTH
+#define _BENCH_DEPTH (3) // Default depth of the bench mode
+#endif
+#define _MICRO_POSITIONS (4096) // Positions of the micro mode, random walks from bench_fens
+#define _MICRO_OPS (1 << 16) // Calls per timed round of a micro primitive
+#define _MICRO_ROUNDS (16) // Default timed rounds per primitive; --iterations
+#define _MICRO_EVAL (6) // Index of eval in micro_names
+#define _DBMAGIC (0x425a4441)
+#define _DBVERSION (1)
+#ifndef _DBMEM
+#define _DBMEM (256) // MB of records dbbuild sorts in memory before spilling a run
+#endif
+#define _EC_CHECK (0) // Eval cache fields
+#define _EC_ECHECK (1)
+#define _EC_MAXCAP (2)
 
 #ifndef _PIECE_CODES
 #define _PIECE_CODES (1)
@@ -71,11 +180,169 @@ typedef u6 NODES;
 typedef double TIME;
 typedef s3 MOVE[6];
 typedef MOVE MOVELIST[_MAXINDEX];
-typedef s3 BOARD[9][8];
+typedef int8_t BOARD[16][8] __attribute__((aligned(64))); // Rows 0-7: squares, rows 8-15: BSTATE
 typedef s4 VALUE;
 typedef u4 LEVEL;
 typedef u4 MOVEINDEX;
 
+typedef struct {
+    int8_t castle[4]; // Same bytes as board[8][0..3]
+    int8_t kings; // Own minus enemy kings
+    int8_t ep; // File + 1 of an enemy pawn that can be taken en passant, 0 if none
+    uint8_t halfmove; // Plies since the last capture or pawn move
+    int8_t spare;
+    u6 key[2]; // Position key, and the same for the transposed board
+    s4 score; // Material and PST total for the side to move
+    u5 pawnkey[2]; // Pawn key, and the same for the transposed board
+    uint16_t dirty[4]; // Squares changed by the last makemove(), for NNUE
+} __attribute__((may_alias)) BSTATE;
+#define STATE(board) ((BSTATE *) &(board)[8][0])
+
+typedef struct {
+    u6 key;
+    s4 value;
+    u5 data; // depth | bound << 8 | move << 10
+} HASHENTRY;
+
+typedef struct {
+    u5 key;
+    s4 value;
+} PAWNENTRY;
+
+typedef struct {
+    const char *name; // Key in a .bpf file; piece values keep their numeric keys
+    VALUE *value;
+    int tune;
+} PARAM;
+
+typedef struct {
+    const char *name;
+    s5 *value;
+    s5 lo; // Range explored by the spsa mode
+    s5 hi;
+} SEARCHPARAM;
+
+typedef struct {
+    float result; // 1, 0.5 or 0 for White
+    s4 base; // Terms that are not tuned
+    int8_t x[_TUNE_MAXPARAMS]; // Coefficient of each parameter, for White
+} TUNEPOS;
+
+typedef struct {
+    char **lines;
+    TUNEPOS *pos;
+    u6 count;
+    u6 kept;
+    double *weight;
+    double k;
+    double error;
+    double grad[_TUNE_MAXPARAMS];
+} TUNEJOB;
+
+typedef struct {
+    VALUE base[_MAXINDEX]; // Static value, or the mate score
+} EVALBATCH;
+
+typedef struct {
+    u6 check; // key ^ data, so a torn entry never matches
+    u6 data; // 4 bits per field: known | 3-bit result
+} EVALENTRY;
+
+typedef struct {
+    u5 hidden;
+    s5 divisor;
+    s5 out_bias;
+    int16_t *ft_bias; // [hidden]
+    int16_t *ft_weights; // [_NNUE_INPUTS][hidden]
+    int8_t *out_weights; // [2][hidden], side to move first
+} NETWORK;
+
+typedef struct {
+    int16_t v[2][_NNUE_MAXH] __attribute__((aligned(32))); // Board and transposed board
+    u6 key;
+} ACCUMULATOR;
+
+typedef struct {
+    u5 magic;
+    u5 version;
+    u6 keysig;
+    u6 count;
+    u6 checksum;
+} HASHHEADER;
+
+typedef struct {
+    char tag[_PGN_MAXTAGS][2][96]; // Name and value
+    s5 ntags;
+    char result[8];
+    BOARD start; // Before the first move, side to move at the bottom
+    s5 start_side;
+    s5 start_moveno;
+    BOARD board; // After the last move read
+    s5 side;
+    s5 moveno;
+    MOVE moves[_PGN_MAXPLIES];
+    s5 plies;
+    s5 skipmoves; // Tags and result only; the moves are neither read nor replayed
+} PGNGAME;
+
+typedef struct {
+    const char *player; // Either side; names match case-insensitively, in part
+    const char *white;
+    const char *black;
+    const char *event;
+    s5 elomin; // Both ratings in range; 0 for no filter
+    s5 elomax;
+    const char *result;
+    const char *fen[_PGNF_MAXPOS]; // Positions reached, any of them
+    u6 key[_PGNF_MAXPOS];
+    s5 side[_PGNF_MAXPOS];
+    s5 npos;
+} PGNFILTER;
+
+typedef struct {
+    u6 occupied; // Square y * 8 + x, White at the bottom
+    uint8_t pieces[16]; // 4 bits each, piece + 6, in the order of `occupied'
+    int16_t score; // Search score for White, centipawns
+    uint8_t result; // 2, 1 or 0 for a White win, draw or Black win
+    uint8_t side; // 1 if Black is to move
+    uint8_t castle; // board[8][0..3] with White at the bottom, and BSTATE ep << 4
+    uint8_t halfmove;
+    uint16_t moveno;
+} DATAPOS; // 32 bytes, written as is: files of them can be appended and mapped
+
+typedef struct SERVEJOB {
+    struct SERVEJOB *next;
+    u6 id;
+    s5 priority; // Higher first, in order of arrival within one
+    s5 fd; // Connection that gets the progress and the result
+    BOARD board;
+    s5 side;
+    s5 moveno;
+    s5 depth; // Limits, 0 for the daemon's own
+    NODES nodes;
+    double time;
+} SERVEJOB;
+
+typedef struct {
+    u5 magic;
+    u5 version;
+    u6 keysig;
+    u6 count;
+} DBHEADER;
+
+typedef struct {
+    u6 key; // board_key(), side to move at the bottom
+    u5 move; // Packed as in the hash table
+    u5 count[3]; // Games won, drawn and lost by the side to move
+} DBENTRY;
+
+typedef enum {
+    HASH_NONE,
+    HASH_UPPER,
+    HASH_LOWER,
+    HASH_EXACT,
+} BOUNDS;
+
 typedef struct {
     int seconds;
     int useconds;
@@ -102,6 +369,43 @@ typedef struct {
     VALUE valuelist[_MAXINDEX];
 } TREE;
 
+typedef struct {
+    NODES evals[2]; // eval() and eval_sibling() calls, main tree and ordering searches
+    NODES captures; // Capture probes of eval_tail(), moves when they are counted as nodes
+    NODES gens;
+    NODES checks; // in_check() calls
+    NODES searches[2][_MAXLEVEL]; // Interior nodes, per tree and ply
+    NODES cutoffs[2][_MAXLEVEL]; // Beta cutoffs
+    NODES firstcuts[2][_MAXLEVEL]; // Beta cutoffs by the first move
+    NODES researches; // Root moves searched again after beating the null window
+    NODES hashprobes;
+    NODES hashhits; // Entry found
+    NODES hashcuts; // Entry deep enough to return its value
+    NODES cacheprobes;
+    NODES cachehits;
+} SEARCHSTATS;
+
+typedef enum {
+    PH_MAIN, // Main tree: search() and makemove() outside the phases below
+    PH_ORDER, // order() and the treeb searches it runs
+    PH_GEN, // gendeep() from gen()
+    PH_EVAL, // Material, PST and pawns, or NNUE
+    PH_CHECK, // In-check probes of eval_tail()
+    PH_GENFAST, // Capture probes of eval_tail()
+    PH_COUNT,
+} PHASES;
+
+typedef struct {
+    u6 cycles[PH_COUNT]; // Exclusive: time in a nested phase counts there
+    u6 calls[PH_COUNT];
+    u6 misses[2][PH_COUNT]; // Cache and branch misses, with _PROFILE 2
+    u6 stamp;
+    u6 counts[2]; // Counter values at stamp
+    PHASES phase;
+    int fd[2];
+    struct perf_event_mmap_page *page[2];
+} PROFILE;
+
 extern ELAPSED elapsed;
 extern LEVEL gdepth;
 extern LEVEL glevel;
@@ -113,12 +417,67 @@ extern int newpv;
 extern int pvsready;
 extern s4 stm;
 
+const char *ckptfile;
+const char *nnuefile;
+const char *valuesfile;
+const char *tunefile;
+const char *outfile;
+const char *batchfile;
+const char *sockfile;
+const char *datafile;
+const char *dbfile; // --db: position statistics for dbquery and root ordering
+char **pgnfiles; // Inputs of dbbuild, pgnfilter and datagen
+s5 npgnfiles;
+u5 gdbmem = _DBMEM;
+PGNFILTER pgnf;
+DBENTRY *gdb; // Mapped entries of dbfile
+u6 gdbcount;
+s5 gthreads;
+NODES gnodelimit;
+s5 giterations;
+s5 ggames;
+const char *bookfile;
+int gresume;
+double ckpttime;
+double gtimelimit = 21500.0;
+_Atomic double gdeadline; // Also moved by the UCI thread on ponderhit
+_Atomic int gabort; // Also set by the UCI thread on stop
+MOVEINDEX gmultipv = 1;
+MOVE gexclude[_MAXMULTIPV];
+MOVEINDEX gnexclude;
+MOVELIST rootorder; // Root moves as first ordered in this iteration, or from a checkpoint
+MOVEINDEX nrootorder;
+MOVE mpv_line[_MAXMULTIPV][_MAXLEVEL]; // Lines of the last completed iteration
+LEVEL mpv_len[_MAXMULTIPV];
+VALUE mpv_value[_MAXMULTIPV];
+MOVEINDEX npvs;
+int gseeded; // checkpoint_load() filled the lines and rootorder for deepen()
+
 extern void init(ELAPSED *elapsed);
 extern void update(ELAPSED *elapsed);
 extern double dclock(ELAPSED *elapsed);
+extern void stats_show(FILE *f);
+extern void prof_open(void);
+extern PHASES prof_enter(PHASES phase);
+extern void prof_leave(PHASES phase);
+extern void prof_show(FILE *f);
 extern void addm(s5 y, s5 x, s5 y1, s5 x1, MOVEINDEX *curr_index, MOVELIST movelist);
 extern void addprom(s5 y, s5 x, s5 y1, s5 x1, s5 to, MOVEINDEX *curr_index, MOVELIST movelist);
 extern int analysis(void);
+extern VALUE deepen(BOARD start, LEVEL sdepth, s5 maxlevel);
+extern void ponder(BOARD start);
+extern void show_line(BOARD start, MOVE *line, LEVEL len, FILE *f);
+extern LEVEL pv_length(BOARD start, MOVE *line, LEVEL len, VALUE value);
+extern s5 mate_moves(VALUE value);
+extern void json_open(void);
+extern void json_close(void);
+extern void json_emit(const char *line);
+extern void json_line(const char *type, BOARD start, VALUE value, MOVE *line, LEVEL len, LEVEL depth, MOVEINDEX multipv);
+extern u5 hash_full(void);
+extern int root_illegal(BOARD start, MOVE move);
+extern MOVEINDEX exclude(MOVELIST movelist, MOVEINDEX max_index);
+extern void extend_line(BOARD start, MOVE *line, LEVEL *len, LEVEL maxlen);
+extern void order(BOARD board, MOVELIST movelist, MOVEINDEX max_index, VALUE *valuelist);
 extern VALUE search(TREE *tree_, LEVEL level, LEVEL depth);
 extern int board_cmp(BOARD src, BOARD dest);
 extern void copy_board(BOARD src, BOARD dest);
@@ -149,8 +508,79 @@ extern void showCI(VALUE value);
 extern void transpose(BOARD board);
 extern void setup_board(BOARD board);
 extern void parse_fen(BOARD board);
-extern void parse_pgn(void);
 extern void save(BOARD board);
+extern void board_fen(BOARD board, s5 side, s5 moveno, char *buf);
+extern int san_move(BOARD board, s5 side, const char *san, MOVE move);
+extern int pgn_setup(PGNGAME *game);
+extern int pgn_next(FILE *f, PGNGAME *game);
+extern long pgn_sync(FILE *f, long from);
+extern s5 pgn_range_next(FILE *f, long to, PGNGAME *game, long *start);
+extern int pgnfilter(char **pgns, s5 npgns);
+extern int serve(const char *path);
+extern void serve_info(BOARD start, VALUE value, MOVE *line, LEVEL len, LEVEL depth, double delapsed);
+extern const char *pgn_tag(PGNGAME *game, const char *name);
+extern void move_san(BOARD board, s5 side, MOVE move, char *buf);
+extern void move_uci(MOVE move, s5 side, char *buf);
+extern int uci_move(BOARD board, s5 side, const char *str, MOVE move);
+extern int uci(void);
+extern int read_position(BOARD start);
+extern void init_psqt(void);
+extern void score_board(BOARD board);
+extern VALUE pawns(BOARD board);
+extern void eval_batch(BOARD *boards, MOVEINDEX n, LEVEL level, EVALBATCH *batch);
+extern VALUE eval_sibling(BOARD board, LEVEL level, VALUE base);
+extern VALUE pawn_side(BOARD board);
+extern void pawn_terms(BOARD board, s4 *terms);
+extern int fen_board(const char *fen, BOARD board, s5 *side, s5 *moveno);
+extern void load_params(const char *name);
+extern void save_params(const char *name);
+extern int tune(const char *name);
+extern int dbbuild(const char *name, char **pgns, s5 npgns);
+extern int dbquery(const char *fen);
+extern int db_open(const char *name);
+extern u6 db_find(u6 key, u6 *count);
+extern void db_order(BOARD board, MOVELIST movelist, MOVEINDEX max_index);
+extern u5 move_pack(MOVE move);
+extern void move_unpack(u5 packed, MOVE move);
+extern VALUE tune_static(BOARD board);
+extern VALUE tune_quiesce(BOARD board, VALUE alpha, VALUE beta, LEVEL ply, BOARD leaf, s5 *sign);
+extern void tune_features(BOARD board, s5 sign, TUNEPOS *pos);
+extern void *tune_load_range(void *arg);
+extern void *tune_error_range(void *arg);
+extern double tune_error(TUNEJOB *jobs, s5 n, double *weight, double k, double *grad);
+extern int set_param(const char *name, s5 value);
+extern int spsa(void);
+extern s5 spsa_game(s5 *plus, s5 *minus, u6 seed, s5 plus_white);
+extern int datagen(const char *name, char **pgns, s5 npgns);
+extern int datadump(const char *name);
+extern void data_pack(BOARD board, s5 side, s5 moveno, VALUE value, DATAPOS *pos);
+extern void data_unpack(DATAPOS *pos, BOARD board);
+extern int think(BOARD board, MOVE move, VALUE *value);
+extern int epd_batch(const char *name);
+extern int bench(s5 depth);
+extern int micro(void);
+extern u6 micro_run(u5 prim, BOARD *boards, MOVE *moves, u5 n, u5 ops);
+extern MOVEINDEX legal_moves(BOARD board, MOVELIST movelist);
+extern int nnue_load(const char *name);
+extern VALUE nnue_eval(BOARD board, LEVEL level);
+extern void nnue_refresh(ACCUMULATOR *acc, BOARD board);
+extern void nnue_update(ACCUMULATOR *parent, ACCUMULATOR *acc, BOARD board);
+extern u6 nnue_parent(BOARD board);
+extern void hash_init(void);
+extern void hash_resize(u5 bits);
+extern u6 hash_board(BOARD board);
+extern u6 board_key(BOARD board);
+extern s5 eval_cache(BOARD board, u5 field);
+extern HASHENTRY *hash_probe(u6 key);
+extern void hash_store(u6 key, VALUE value, LEVEL depth, s5 bound, MOVE move, LEVEL level);
+extern VALUE hash_value(HASHENTRY *entry, LEVEL level);
+extern LEVEL hash_depth(HASHENTRY *entry);
+extern s5 hash_bound(HASHENTRY *entry);
+extern void hash_move(HASHENTRY *entry, MOVE move);
+extern void hash_save(const char *name);
+extern void hash_load(const char *name);
+extern void checkpoint_save(const char *name, BOARD start, LEVEL depth);
+extern LEVEL checkpoint_load(const char *name, BOARD start);
 
 const VALUE _ALPHA_DFL    = (-20000);
 const VALUE _BETA_DFL     = (+20000);
@@ -158,100 +588,307 @@ const VALUE _MAXVALUE     = (20000);
 const VALUE _PAWNUNIT     = (100);
 const VALUE _THRESHOLD    = (15000);
 VALUE _VALUES[6];
+VALUE _PAWNRANK[8] = { 0, 100, 100, 100, 120, 200, 400, 0, };
+const VALUE _CENTRE[64] = {
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 2, 2, 2, 2, 2, 2, 1,
+    1, 2, 3, 3, 3, 3, 2, 1,
+    1, 2, 3, 4, 4, 3, 2, 1,
+    1, 2, 3, 4, 4, 3, 2, 1,
+    1, 2, 3, 3, 3, 3, 2, 1,
+    1, 2, 2, 2, 2, 2, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+};
+VALUE psqt[13][64];
+VALUE _PASSED[8] = { 0, 5, 10, 20, 35, 60, 100, 0, };
+VALUE _ISOLATED = (12);
+VALUE _DOUBLED = (10);
+VALUE _BACKWARD = (8);
+PARAM params[] = {
+    { "1", &_VALUES[1], 0 }, { "2", &_VALUES[2], 1 }, { "3", &_VALUES[3], 1 },
+    { "4", &_VALUES[4], 1 }, { "5", &_VALUES[5], 1 },
+    { "rank1", &_PAWNRANK[1], 1 }, { "rank2", &_PAWNRANK[2], 1 }, { "rank3", &_PAWNRANK[3], 1 },
+    { "rank4", &_PAWNRANK[4], 1 }, { "rank5", &_PAWNRANK[5], 1 }, { "rank6", &_PAWNRANK[6], 1 },
+    { "passed1", &_PASSED[1], 1 }, { "passed2", &_PASSED[2], 1 }, { "passed3", &_PASSED[3], 1 },
+    { "passed4", &_PASSED[4], 1 }, { "passed5", &_PASSED[5], 1 }, { "passed6", &_PASSED[6], 1 },
+    { "isolated", &_ISOLATED, 1 }, { "doubled", &_DOUBLED, 1 }, { "backward", &_BACKWARD, 1 },
+};
+#define _NPARAMS ((u5) (sizeof(params) / sizeof(params[0])))
+s5 gsdepth = _S_DEPTH; // Depth of the ordering searches
+s5 goverdepth = _OVERDEPTH; // Plies searched beyond the reported depth
+#ifdef _CAND7
+s5 gcandwidth = 6; // Moves kept below the root, 0 for all
+#else
+s5 gcandwidth = 0;
+#endif
+#ifdef _CAND250
+s5 gcandcut = _CANDCUT; // Moves this far below the best are dropped, 0 for none
+#else
+s5 gcandcut = 0;
+#endif
+s5 gnoise = 3; // Eval noise of (nodes mod 2^gnoise), centred on zero
+SEARCHPARAM sparams[] = {
+    { "sdepth", &gsdepth, 1, 6 },
+    { "overdepth", &goverdepth, 0, 4 },
+    { "candwidth", &gcandwidth, 2, 16 },
+    { "candcut", &gcandcut, 0, 600 },
+    { "noise", &gnoise, 0, 5 },
+};
+#define _NSPARAMS ((u5) (sizeof(sparams) / sizeof(sparams[0])))
+PAWNENTRY pawntable[1 << _PAWNBITS];
+EVALENTRY evaltable[1 << _EVALBITS];
+NETWORK network;
+ACCUMULATOR accstack[2][_MAXLEVEL + 1];
+int gnnue;
+s5 gstack;
+BOARD frontier[2][_MAXINDEX]; // Children of the current frontier node, per tree
+EVALBATCH batch[2];
+NODES evalprobes;
+NODES evalhits;
 
 ELAPSED elapsed;
 LEVEL gdepth;
+LEVEL gcompleted; // Last depth deepen() finished
+LEVEL gseldepth; // Deepest level reached in the current iteration
+SEARCHSTATS gstats; // Counted only if _STATS, for the current iteration
+PROFILE gprof; // Filled only if _PROFILE, for the whole analysis
+int gjson; // --json: NDJSON progress on stdout instead of text
+char *jsonbuf[2]; // Filled by the search, drained by json_writer()
+size_t jsonlen;
+size_t jsonsize[2];
+int jsondone;
+pthread_mutex_t jsonlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jsoncond = PTHREAD_COND_INITIALIZER;
+pthread_t jsonthread;
+MOVE jsonbest; // Summary of the last completed iteration
+VALUE jsonvalue;
+LEVEL jsondepth;
+BOARD jsonroot;
 LEVEL glevel;
 MOVE best_move;
 NODES nodes;
 TREE *treea;
 TREE *treeb;
+TREE trees[2][_MAXLEVEL];
 int newpv;
 int pvsready;
 s4 stm;
+HASHENTRY *hashtable;
+u5 ghashbits = _HASHBITS; // UCI Hash option
+const char *hashfile;
+volatile sig_atomic_t gstop;
+u6 zobrist[13][64];
+u6 zobrist_castle[4];
+u6 zobrist_ep[9]; // By BSTATE ep, none for 0
+u5 zobrist_pawn[2][64];
+
+typedef enum {
+    INPUT_BRD, // start.brd
+    INPUT_PGN, // --pgn, the position after the first game
+    INPUT_FEN, // --fen, or the first line of start.fen
+    INPUT_PGNFEN, // --pgn, printed as FEN by read_position()
+} INPUTS;
 
 typedef enum {
     NONE,
     ANALYSIS,
     EVAL,
     GO,
+    PONDER,
+    TUNE,
+    SPSA,
+    BATCH,
+    UCI,
+    DBBUILD,
+    DBQUERY,
+    PGNFILTERING,
+    SERVE,
+    DATAGEN,
+    DATADUMP,
+    BENCH,
+    MICRO,
 } MODES;
 
 MODES gmode = NONE;
+INPUTS ginput = _NOEDIT;
+const char *gfen;
+const char *gpgn = "start.pgn";
+s5 gwindow = _WINDOW; // Root search window is -gwindow..gwindow
+s5 gmaxdepth; // 0 for the default of the mode
+s5 gchess960 = _CHESS960;
+int gprintfen; // --print-fen: read_position() prints the root FEN and exits
 s5 exit_code = 0;
 
 int analysis(void)
 {
-    BOARD aux;
-    BOARD aux2;
     BOARD start;
     char buf[80];
-    LEVEL depth;
-    LEVEL i;
-    TREE *tree;
+    VALUE best;
     s4 ix = 0;
-#if _NOEDIT == 3
-    parse_pgn();
-    exit(0);
-#elif _NOEDIT == 2
-    parse_fen(start);
-    save(start);
-#elif _NOEDIT == 1
-    parse_pgn();
-    load(start);
-#else
-    load(start);
-//    setup_board(start);
-//    copy_board(*get_init(), start);
-//    save(start);
-#endif
-    if (gmode == ANALYSIS)
-        show_board(start, stdout);
-    static TREE treea_static[_MAXLEVEL];
-    static TREE treeb_static[_MAXLEVEL];
-    
-    treea = treea_static;
-    treeb = treeb_static;
     init(&elapsed);
     nodes = 0LL;
     pvsready = 0;
+    LEVEL sdepth = gsdepth + 1;
+    if (gresume) {
+        sdepth = checkpoint_load(ckptfile, start);
+    } else {
+        if (!read_position(start))
+            return (1);
+    }
+    if (gmode == ANALYSIS)
+    if (!gjson)
+        show_board(start, stdout);
+    if (gmode == PONDER) {
+        ponder(start);
+        return 0;
+    }
+    HASHENTRY *entry = hash_probe(board_key(start));
+    if (!gresume)
+    if (entry)
+    if (hash_depth(entry) > sdepth + goverdepth) {
+        // Redo the last stored iteration from the table to rebuild the PV
+        sdepth = hash_depth(entry) - goverdepth;
+        hash_move(entry, best_move);
+        if (gmode == ANALYSIS || gmode == GO)
+        if (!gjson) {
+            show_move(best_move, start, stm % 2, buf);
+            fprintf(stdout, "Hash: %s %.2lf depth %u\n\n", buf, \
+                0.01 * (double) hash_value(entry, 0), sdepth);
+            fflush(stdout);
+        }
+    }
     s5 maxlevel = _MAXLEVEL;
     if (gmode == GO)
 	    maxlevel = _MAXLEVEL_GO;
     if (gmode == EVAL)
 	    maxlevel = _MAXLEVEL_EVAL;
-    for (depth = _S_DEPTH + 1; depth < maxlevel; depth++) {
+    if (gmaxdepth > 0)
+        maxlevel = (gmaxdepth + 1 < _MAXLEVEL) ? gmaxdepth + 1 : _MAXLEVEL;
+    PROF(prof_open());
+    best = deepen(start, sdepth, maxlevel);
+    PROF(prof_leave(PH_MAIN));
+    if (gmode == ANALYSIS) {
+        PROF(prof_show(gjson ? stderr : stdout));
+        exit_code = 0;
+    } else if (gmode == GO) {
+        show_move(best_move, start, stm % 2, buf);
+        if (!gjson)
+	    printf("%s\n", buf);
+	exit_code = 0;
+    } else if (gmode == EVAL) {
+	exit_code = best;
+    }
+    return exit_code;
+}
+
+VALUE deepen(BOARD start, LEVEL sdepth, s5 maxlevel)
+// Iterative deepening from `sdepth'; returns the score of the last completed iteration
+{
+    char buf[80];
+    LEVEL depth;
+    LEVEL i;
+    TREE *tree;
+    VALUE best = treea[0].best;
+    MOVEINDEX pv;
+    if (!gseeded)
+        npvs = 0;
+    if (sdepth >= maxlevel)
+        sdepth = maxlevel - 1;
+    for (depth = sdepth; depth < maxlevel; depth++) {
         tree = &treea[0];
+        gseldepth = 0;
+        STAT(memset(&gstats, 0, sizeof(gstats)));
+        if (!gseeded)
+            nrootorder = 0;
+        gseeded = 0;
+        // Each further pass searches the root without the moves already found
+        for (pv = 0; pv < gmultipv; pv++) {
         copy_board(start, tree->curr_board);
         tree->level = 0;
-        tree->depth = depth + _OVERDEPTH;
+        tree->depth = depth + goverdepth;
         gdepth = tree->depth;
-        tree->alpha = _ALPHA;
-        tree->beta = _BETA;
+        tree->alpha = -gwindow;
+        tree->beta = gwindow;
         newpv = 0;
+        if (pv) {
+            tree->bl_len = (pv < npvs) ? mpv_len[pv] : 0;
+            for (i = 0; i < tree->bl_len; i++)
+                copy_move(mpv_line[pv][i], tree->best_line[i]);
+        }
+        gnexclude = pv;
         tree->best = search(treea, 0, 1);
+        if (gabort)
+            break;
+        if (pv)
+        if (tree->max_index == 0 || root_illegal(start, tree->best_line[0]))
+            break;
+        mpv_value[pv] = tree->best;
+        extend_line(start, tree->best_line, &tree->bl_len, depth);
+        mpv_len[pv] = tree->bl_len;
+        for (i = 0; i < tree->bl_len; i++)
+            copy_move(tree->best_line[i], mpv_line[pv][i]);
+        copy_move(tree->best_line[0], gexclude[pv]);
+        }
+        gnexclude = 0;
+        if (gabort)
+            break;
+        npvs = pv;
+        tree->best = mpv_value[0];
+        tree->bl_len = mpv_len[0];
+        for (i = 0; i < tree->bl_len; i++)
+            copy_move(mpv_line[0][i], tree->best_line[i]);
+        best = tree->best;
+        gcompleted = depth;
         pvsready = 1;
         update(&elapsed);
         double delapsed = dclock(&elapsed);
-        copy_board(start, aux);
-	if (gmode == ANALYSIS) {
+	if (gjson) {
+		for (pv = 0; pv < npvs; pv++)
+		    json_line("iteration", start, mpv_value[pv], mpv_line[pv], mpv_len[pv], depth, pv);
+		copy_board(start, jsonroot);
+		copy_move(mpv_line[0][0], jsonbest);
+		jsonvalue = mpv_value[0];
+		jsondepth = depth;
+	} else if (gmode == ANALYSIS) {
 		fprintf(stdout, "Depth: %u\n", depth);
 		fprintf(stdout, "Evaluation: %.2lf\n", 0.01 * (double) tree->best);
 		fprintf(stdout, "Branching factor: %.2lf\n", pow((double) nodes, (double) 1 / (depth)));
 		fprintf(stdout, "Best variation: ");
-		for (i = 0; i < tree->bl_len; i++) {
-		    show_move(tree->best_line[i], aux, (i + stm) % 2, buf);
-		    makemove(aux, tree->best_line[i], aux2);
-		    copy_board(aux2, aux);
-		    fprintf(stdout, "%s ", buf);
+		show_line(start, tree->best_line, tree->bl_len, stdout);
+		for (pv = 1; pv < npvs; pv++) {
+		    fprintf(stdout, "Variation %u: %.2lf ", pv + 1, 0.01 * (double) mpv_value[pv]);
+		    show_line(start, mpv_line[pv], mpv_len[pv], stdout);
 		}
-		fprintf(stdout, "\n");
-		if (tree->bl_len & 1)
-		    transpose(aux);
 		fprintf(stdout, "Elapsed: %.2lf\n", delapsed);
 		fprintf(stdout, "NPS: %u\n", (unsigned int) ((double) nodes / delapsed));
+		fprintf(stdout, "Eval cache: %.1lf%%\n", 100.0 * (double) evalhits / (double) (evalprobes + !evalprobes));
+		STAT(stats_show(stdout));
 		fprintf(stdout, "\n");
 		fflush(stdout);
+	} else if (gmode == SERVE) {
+		serve_info(start, mpv_value[0], mpv_line[0], mpv_len[0], depth, delapsed);
+	} else if (gmode == UCI) {
+		for (pv = 0; pv < npvs; pv++) {
+		    VALUE v = mpv_value[pv];
+		    LEVEL j;
+		    LEVEL len = pv_length(start, mpv_line[pv], mpv_len[pv], v);
+		    fprintf(stdout, "info depth %u seldepth %u", depth, gseldepth);
+		    if (gmultipv > 1)
+		        fprintf(stdout, " multipv %u", pv + 1);
+		    if (v > _THRESHOLD || v < -_THRESHOLD)
+		        fprintf(stdout, " score mate %d", mate_moves(v));
+		    else
+		        fprintf(stdout, " score cp %d", v);
+		    fprintf(stdout, " nodes %llu nps %u hashfull %u time %u pv", nodes, \
+		        (unsigned int) ((double) nodes / (delapsed + !delapsed)), hash_full(), \
+		        (unsigned int) (1000.0 * delapsed));
+		    for (j = 0; j < len; j++) {
+		        move_uci(mpv_line[pv][j], (stm + j) % 2, buf);
+		        fprintf(stdout, " %s", buf);
+		    }
+		    fprintf(stdout, "\n");
+		}
+		fflush(stdout);
 	} else if (gmode == GO) {
 		fprintf(stdout, "Depth: %u\n", depth);
 		fprintf(stdout, "Evaluation: %.2lf\n", 0.01 * (double) tree->best);
@@ -266,228 +903,723 @@ int analysis(void)
 		fflush(stdout);
 	}
 	copy_move(tree->best_line[0], best_move);
+        if (ckptfile)
+        if (gmode != PONDER) {
+            checkpoint_save(ckptfile, start, depth);
+            if (hashfile)
+                hash_save(hashfile);
+        }
     }
-    if (gmode == ANALYSIS) {
-        exit_code = 0;
-    } else if (gmode == GO) {
-        show_move(best_move, start, stm % 2, buf);
-	printf("%s\n", buf);
-	exit_code = 0;
-    } else if (gmode == EVAL) {
-        s5 best = tree->best;
-	exit_code = best;
-    }
-    free(treea);
-    free(treeb);
-    return exit_code;
+    return (best);
 }
 
-VALUE search(TREE *tree_, LEVEL level, LEVEL depth)
-// level means distance from root
-// depth means 1 if treea, 0 if treeb
+void show_line(BOARD start, MOVE *line, LEVEL len, FILE *f)
 {
     BOARD aux;
     BOARD aux2;
     char buf[80];
-    LEVEL bl_lev;
     LEVEL i;
-    TREE *tree;
-    TREE *ntree;
-    VALUE value;
-    tree = &tree_[level];
-    value = eval(tree->curr_board, level);
-    if (newpv)
-	tree->bl_len = 0;
-    if (value < -_THRESHOLD) {
-        return (value);
-    }
-    if (tree->depth == 0) {
-        return (value);
+    copy_board(start, aux);
+    for (i = 0; i < len; i++) {
+        show_move(line[i], aux, (i + stm) % 2, buf);
+        makemove(aux, line[i], aux2);
+        copy_board(aux2, aux);
+        fprintf(f, "%s ", buf);
     }
-    if (tree->depth <= _OVERDEPTH)
-    if (value > -(_PAWNUNIT >> 1)) {
-        return (value);
-    }
-    if (depth)
-        glevel = level;
-    tree->max_index = gen(tree->curr_board, tree->legal_moves, depth);
-    if (tree->max_index == 0) {
-        return (-_MAXVALUE + level);
+    fprintf(f, "\n");
+}
+
+LEVEL pv_length(BOARD start, MOVE *line, LEVEL len, VALUE value)
+// Moves of a line worth reporting: up to the mating move, and never the
+// king capture that scores a mate
+{
+    BOARD aux;
+    BOARD aux2;
+    LEVEL i;
+    s5 plies = (value > _THRESHOLD) ? _MAXVALUE - value - 2 : \
+        (value < -_THRESHOLD) ? _MAXVALUE + value - 2 : -1;
+    if (plies >= 0 && len > (LEVEL) plies)
+        len = plies;
+    copy_board(start, aux);
+    for (i = 0; i < len; i++) {
+        if (aux[(u5) line[i][2]][(u5) line[i][3]] == _BK)
+            break;
+        makemove(aux, line[i], aux2);
+        copy_board(aux2, aux);
     }
-    if (newpv)
-	tree->bl_len = 1;
-    tree->best = -_MAXVALUE;
-    TREE *ntree_base = &tree_[level + 1];
-    for (tree->curr_index = 0; tree->curr_index < tree->max_index; (tree->curr_index)++) {
-        ntree = ntree_base;
-        copy_move(tree->legal_moves[tree->curr_index], tree->curr_move);
-        makemove(tree->curr_board, tree->curr_move, tree->next_board);
-        copy_board(tree->next_board, ntree->curr_board);
-#ifdef _SVP
-        if (depth)
-        if (level < 1)
-        if (tree->curr_index) {
-            ntree->level = tree->level + 1;
-            ntree->depth = tree->depth - 1;
-            ntree->alpha = -(tree->alpha) - 1;
-            ntree->beta = -(tree->alpha);
-            tree->value = -search(tree_, level + 1, depth);
-            if (tree->value <= tree->alpha)
-                continue;
+    return (i);
+}
+
+s5 mate_moves(VALUE value)
+// Moves to mate for a score past _THRESHOLD, negative when being mated
+{
+    if (value > 0)
+        return ((_MAXVALUE - value) / 2);
+    return (-((_MAXVALUE + value) / 2 - 1));
+}
+
+void json_emit(const char *line)
+// Queues one line for json_writer(); the search never waits on stdout
+{
+    size_t n = strlen(line);
+    pthread_mutex_lock(&jsonlock);
+    if (jsonlen + n + 1 > jsonsize[0]) {
+        size_t size = 2 * (jsonlen + n + 1);
+        char *p = (char *) realloc(jsonbuf[0], size);
+        if (!p) {
+            pthread_mutex_unlock(&jsonlock);
+            return;
         }
-#endif
-        ntree->level = tree->level + 1;
-        ntree->depth = tree->depth - 1;
-        ntree->alpha = -(tree->beta);
-        ntree->beta = -(tree->alpha);
-        tree->value = -search(tree_, level + 1, depth);
-        if (!newpv)
-            ntree->bl_len = 0;
-        newpv = 1;
-        if (tree->value > tree->best) {
-            tree->best = tree->value;
-            tree->bl_len = ntree->bl_len + 1;
-            copy_move(tree->curr_move, tree->best_line[0]);
-            if (ntree->bl_len > 0)
-            for (bl_lev = 0; bl_lev < ntree->bl_len; bl_lev++)
-                copy_move(ntree->best_line[bl_lev], \
-                    tree->best_line[bl_lev + 1]);
-	    if (0) {
-            //if (level == 0 && depth == 1 && gmode == 4) {
-                update(&elapsed);
-                double delapsed = dclock(&elapsed);
-                copy_board(treea->curr_board, aux);
-                fprintf(stdout, "Depth: %u*\n", treea->depth - _OVERDEPTH);
-                fprintf(stdout, "Evaluation: ");
-showCI(treea->best);
-                fprintf(stdout, "\nBranching factor: %.2lf\n", pow((double) nodes, (double) 1 / (treea->depth - _OVERDEPTH)));
-                fprintf(stdout, "Best variation: ");
-                for (i = 0; i < treea->bl_len; i++) {
-                    show_move(treea->best_line[i], aux, (i + stm) % 2, buf);
-                    makemove(aux, treea->best_line[i], aux2);
-                    copy_board(aux2, aux);
-                    fprintf(stdout, "%s ", buf);
-                }
-                fprintf(stdout, "\n");
-                if (treea->bl_len & 1)
-                    transpose(aux);
-                fprintf(stdout, "Elapsed: %.2lf\n", delapsed);
-		fprintf(stdout, "NPS: %u\n", (unsigned int) ((double) nodes / delapsed));
-                fprintf(stdout, "\n");
-                fflush(stdout);
-            }
-            if (tree->best > tree->alpha)
-                tree->alpha = tree->best;
-            if (tree->alpha >= tree->beta)
-                return (tree->beta);
+        jsonbuf[0] = p;
+        jsonsize[0] = size;
+    }
+    memcpy(jsonbuf[0] + jsonlen, line, n);
+    jsonlen += n;
+    jsonbuf[0][jsonlen++] = '\n';
+    pthread_cond_signal(&jsoncond);
+    pthread_mutex_unlock(&jsonlock);
+}
+
+void *json_writer(void *arg)
+// Swaps the two buffers and writes the full one outside the lock
+{
+    char *p;
+    size_t size;
+    size_t n;
+    ssize_t r;
+    (void) arg;
+    pthread_mutex_lock(&jsonlock);
+    while (1) {
+        while (!jsonlen && !jsondone)
+            pthread_cond_wait(&jsoncond, &jsonlock);
+        if (!jsonlen)
+            break;
+        p = jsonbuf[0];
+        size = jsonsize[0];
+        n = jsonlen;
+        jsonbuf[0] = jsonbuf[1];
+        jsonsize[0] = jsonsize[1];
+        jsonbuf[1] = p;
+        jsonsize[1] = size;
+        jsonlen = 0;
+        pthread_mutex_unlock(&jsonlock);
+        while (n > 0 && (r = write(1, p, n)) > 0) {
+            p += r;
+            n -= r;
         }
+        pthread_mutex_lock(&jsonlock);
     }
-    return (tree->best);
+    pthread_mutex_unlock(&jsonlock);
+    return (NULL);
 }
 
-#define abs(x) ((x > 0) ? (x) : ((-x)))
-#define min(x, y) (((x) < (y)) ? (x) : (y))
-VALUE eval(BOARD board, LEVEL level)
+void json_open(void)
 {
-    BOARD aux;
-    int ivalue = 0;
-    int kings = 0;
-    u5 x;
-    u5 y;
-    VALUE pvalue = 0;
-    VALUE value;
-    nodes++;
-    if ((nodes % _SKIPFRAMES) == 0) {
-        update(&elapsed);
-        double delapsed = dclock(&elapsed);
-	if (gmode == GO)
-	if (delapsed > 21500.0)
-		exit(0);
+    jsonbest[0] = -1;
+    if (pthread_create(&jsonthread, NULL, json_writer, NULL)) {
+        warn("Cannot start output thread");
+        exit(1);
     }
-    for (y = 0; y < 8; y++)
-    for (x = 0; x < 8; x++) {
-        switch (board[y][x]) {
-        case _WP:
-            switch (y) {
-            case 1:
-            case 2:
-            case 3:
-                ivalue += 100;
-                break;
-            case 4:
-                ivalue += 120;
-                break;
-            case 5:
-                ivalue += 200;
-                break;
-            case 6:
-                ivalue += 400;
-            default:;
-            }
-            break;
-        case _WN:
-        case _WB:
-        case _WR:
-        case _WQ:
-            ivalue += _VALUES[(u5) board[y][x]];
-            break;
-        case _BP:
-            switch (y) {
-            case 6:
-            case 5:
-            case 4:
-                ivalue -= 100;
-                break;
-            case 3:
-                ivalue -= 120;
-                break;
-            case 2:
-                ivalue -= 200;
-                break;
-            case 1:
-                ivalue -= 400;
-                break;
-            default:;
+    atexit(json_close);
+}
+
+void json_close(void)
+// The summary object, then waits for the writer; runs at exit
+{
+    char line[512];
+    char mate[32] = "";
+    char san[16];
+    char uci[8];
+    update(&elapsed);
+    double delapsed = dclock(&elapsed);
+    if (jsonbest[0] >= 0) {
+        move_san(jsonroot, stm % 2, jsonbest, san);
+        move_uci(jsonbest, stm % 2, uci);
+        if (jsonvalue > _THRESHOLD || jsonvalue < -_THRESHOLD)
+            sprintf(mate, ",\"mate\":%d", mate_moves(jsonvalue));
+        snprintf(line, sizeof(line), "{\"type\":\"summary\",\"bestmove_san\":\"%s\",\"bestmove_uci\":\"%s\"," \
+            "\"score\":%d%s,\"depth\":%u,\"nodes\":%llu,\"nps\":%u,\"elapsed\":%.3lf}", \
+            san, uci, jsonvalue, mate, jsondepth, nodes, \
+            (unsigned int) ((double) nodes / (delapsed + !delapsed)), delapsed);
+    } else {
+        snprintf(line, sizeof(line), "{\"type\":\"summary\",\"bestmove_san\":null,\"bestmove_uci\":null," \
+            "\"depth\":0,\"nodes\":%llu,\"elapsed\":%.3lf}", nodes, delapsed);
+    }
+    json_emit(line);
+    pthread_mutex_lock(&jsonlock);
+    jsondone = 1;
+    pthread_cond_signal(&jsoncond);
+    pthread_mutex_unlock(&jsonlock);
+    pthread_join(jsonthread, NULL);
+}
+
+void json_line(const char *type, BOARD start, VALUE value, MOVE *line, LEVEL len, LEVEL depth, MOVEINDEX multipv)
+// One progress object: "iteration" when a depth completes, "pv" when the
+// root move changes within one
+{
+    char out[8192];
+    char buf[16];
+    BOARD aux;
+    BOARD aux2;
+    char *p = out;
+    char *end = out + sizeof(out) - 64;
+    LEVEL i;
+    update(&elapsed);
+    double delapsed = dclock(&elapsed);
+    len = pv_length(start, line, len, value);
+    p += sprintf(p, "{\"type\":\"%s\",\"depth\":%u,\"seldepth\":%u,\"multipv\":%u,\"score\":%d", \
+        type, depth, gseldepth, multipv + 1, value);
+    if (value > _THRESHOLD || value < -_THRESHOLD)
+        p += sprintf(p, ",\"mate\":%d", mate_moves(value));
+    p += sprintf(p, ",\"bound\":\"%s\",\"nodes\":%llu,\"nps\":%u,\"elapsed\":%.3lf,\"hashfull\":%u", \
+        !strcmp(type, "pv") ? "lower" : (value <= -gwindow) ? "upper" : (value >= gwindow) ? "lower" : "exact", \
+        nodes, (unsigned int) ((double) nodes / (delapsed + !delapsed)), delapsed, hash_full());
+    p += sprintf(p, ",\"pv_san\":[");
+    copy_board(start, aux);
+    for (i = 0; i < len && p < end; i++) {
+        move_san(aux, (stm + i) % 2, line[i], buf);
+        p += sprintf(p, "%s\"%s\"", i ? "," : "", buf);
+        makemove(aux, line[i], aux2);
+        copy_board(aux2, aux);
+    }
+    p += sprintf(p, "],\"pv_uci\":[");
+    for (i = 0; i < len && p < end; i++) {
+        move_uci(line[i], (stm + i) % 2, buf);
+        p += sprintf(p, "%s\"%s\"", i ? "," : "", buf);
+    }
+    sprintf(p, "]}");
+    json_emit(out);
+}
+
+void stats_show(FILE *f)
+// The _STATS counters of the last iteration, then main tree and ordering
+// searches side by side per ply
+{
+    SEARCHSTATS *st = &gstats;
+    NODES cuts[2] = { 0, 0 };
+    NODES first[2] = { 0, 0 };
+    LEVEL level;
+    s5 t;
+    for (t = 0; t < 2; t++)
+    for (level = 0; level < _MAXLEVEL; level++) {
+        cuts[t] += st->cutoffs[t][level];
+        first[t] += st->firstcuts[t][level];
+    }
+    fprintf(f, "Evals: %llu main, %llu ordering\n", st->evals[0], st->evals[1]);
+    fprintf(f, "Capture probes: %llu\n", st->captures);
+    fprintf(f, "Gen calls: %llu, in_check calls: %llu\n", st->gens, st->checks);
+    fprintf(f, "Beta cutoffs: %llu main (%.1lf%% first move), %llu ordering (%.1lf%% first move)\n", \
+        cuts[0], 100.0 * first[0] / (cuts[0] + !cuts[0]), cuts[1], 100.0 * first[1] / (cuts[1] + !cuts[1]));
+    fprintf(f, "Re-searches: %llu\n", st->researches);
+    fprintf(f, "Hash: %llu probes, %.1lf%% hits, %.1lf%% cutoffs\n", st->hashprobes, \
+        100.0 * st->hashhits / (st->hashprobes + !st->hashprobes), \
+        100.0 * st->hashcuts / (st->hashprobes + !st->hashprobes));
+    fprintf(f, "Eval cache this iteration: %llu probes, %.1lf%% hits\n", st->cacheprobes, \
+        100.0 * st->cachehits / (st->cacheprobes + !st->cacheprobes));
+    fprintf(f, "Ply %12s %10s %6s %12s %10s %6s\n", "Main", "Cutoffs", "First", "Ordering", "Cutoffs", "First");
+    for (level = 0; level < _MAXLEVEL; level++) {
+        if (!st->searches[0][level] && !st->searches[1][level])
+            continue;
+        fprintf(f, "%3u", level);
+        for (t = 0; t < 2; t++)
+            fprintf(f, " %12llu %10llu %5.1lf%%", st->searches[t][level], st->cutoffs[t][level], \
+                100.0 * st->firstcuts[t][level] / (st->cutoffs[t][level] + !st->cutoffs[t][level]));
+        fprintf(f, "\n");
+    }
+}
+
+#if _PROFILE
+static inline u6 prof_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (__rdtsc());
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((u6) t.tv_sec * 1000000000ULL + t.tv_nsec);
+#endif
+}
+
+static inline u6 prof_counter(s5 c)
+// Counter c of this thread, by rdpmc when the kernel allows it
+{
+    struct perf_event_mmap_page *pc = gprof.page[c];
+    u6 count = 0;
+    u5 seq;
+    u5 index;
+    if (gprof.fd[c] < 0)
+        return (0);
+#if defined(__x86_64__) || defined(__i386__)
+    if (pc && pc->cap_user_rdpmc) {
+        do {
+            seq = pc->lock;
+            __sync_synchronize();
+            index = pc->index;
+            count = pc->offset;
+            if (index) {
+                s6 pmc = __rdpmc(index - 1);
+                pmc <<= 64 - pc->pmc_width;
+                pmc >>= 64 - pc->pmc_width;
+                count += pmc;
             }
+            __sync_synchronize();
+        } while (pc->lock != seq);
+        return (count);
+    }
+#endif
+    if (read(gprof.fd[c], &count, sizeof(count)) != sizeof(count))
+        count = 0;
+    return (count);
+}
+
+static inline void prof_account(void)
+// Charges the time and misses since the last switch to the current phase
+{
+    u6 now = prof_clock();
+    s5 c;
+    gprof.cycles[gprof.phase] += now - gprof.stamp;
+    gprof.stamp = now;
+#if _PROFILE > 1
+    for (c = 0; c < 2; c++) {
+        u6 count = prof_counter(c);
+        gprof.misses[c][gprof.phase] += count - gprof.counts[c];
+        gprof.counts[c] = count;
+    }
+#else
+    (void) c;
+#endif
+}
+
+PHASES prof_enter(PHASES phase)
+// Returns the phase to give back to prof_leave()
+{
+    PHASES prev = gprof.phase;
+    prof_account();
+    gprof.calls[phase]++;
+    gprof.phase = phase;
+    return (prev);
+}
+
+void prof_leave(PHASES phase)
+{
+    prof_account();
+    gprof.phase = phase;
+}
+
+void prof_open(void)
+// Starts the profile in PH_MAIN. Hardware counters need _PROFILE 2 and a
+// kernel that lets this user count its own events; without them only
+// cycles are kept.
+{
+    u5 configs[2] = { PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+    struct perf_event_attr attr;
+    s5 c;
+    memset(&gprof, 0, sizeof(gprof));
+    for (c = 0; c < 2; c++) {
+        gprof.fd[c] = -1;
+        if (_PROFILE < 2)
+            continue;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[c];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        gprof.fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (gprof.fd[c] < 0) {
+            warn("perf_event_open failed, counting cycles only");
+            break;
+        }
+        gprof.page[c] = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, gprof.fd[c], 0);
+        if (gprof.page[c] == MAP_FAILED)
+            gprof.page[c] = NULL;
+    }
+    gprof.phase = PH_MAIN;
+    gprof.stamp = prof_clock();
+    gprof.counts[0] = prof_counter(0);
+    gprof.counts[1] = prof_counter(1);
+}
+
+void prof_show(FILE *f)
+// Share of the cycles per phase, with the misses when they were counted
+{
+    const char *names[PH_COUNT] = { "Main tree", "Ordering", "Move gen", "Eval", "Check probes", "genFast" };
+    u6 total = 0;
+    s5 p;
+    s5 c;
+    for (p = 0; p < PH_COUNT; p++)
+        total += gprof.cycles[p];
+    fprintf(f, "Profile%s:\n", (gprof.fd[0] >= 0) ? "" : " (cycles only)");
+    fprintf(f, "%-14s %16s %6s %12s %8s", "Phase", "Cycles", "%", "Calls", "Per call");
+    if (gprof.fd[0] >= 0)
+        fprintf(f, " %14s %14s", "Cache misses", "Branch misses");
+    fprintf(f, "\n");
+    for (p = 0; p < PH_COUNT; p++) {
+        fprintf(f, "%-14s %16llu %5.1lf%% %12llu %8.0lf", names[p], gprof.cycles[p], \
+            100.0 * (double) gprof.cycles[p] / (double) (total + !total), gprof.calls[p], \
+            gprof.calls[p] ? (double) gprof.cycles[p] / (double) gprof.calls[p] : 0.0);
+        if (gprof.fd[0] >= 0)
+        for (c = 0; c < 2; c++)
+            fprintf(f, " %14llu", gprof.misses[c][p]);
+        fprintf(f, "\n");
+    }
+    fflush(f);
+    for (c = 0; c < 2; c++)
+    if (gprof.fd[c] >= 0)
+        close(gprof.fd[c]);
+}
+#endif
+
+void extend_line(BOARD start, MOVE *line, LEVEL *len, LEVEL maxlen)
+// Completes a line cut short by hash cutoffs with the stored hash moves
+{
+    BOARD aux;
+    BOARD aux2;
+    MOVELIST movelist;
+    MOVEINDEX max_index;
+    MOVEINDEX curr_index;
+    HASHENTRY *entry;
+    LEVEL i;
+    copy_board(start, aux);
+    for (i = 0; i < *len; i++) {
+        makemove(aux, line[i], aux2);
+        copy_board(aux2, aux);
+    }
+    while (*len < maxlen) {
+        entry = hash_probe(board_key(aux));
+        if (!entry || hash_bound(entry) == HASH_UPPER)
+            return;
+        hash_move(entry, line[*len]);
+        max_index = gendeep(aux, movelist, 1);
+        for (curr_index = 0; curr_index < max_index; curr_index++)
+        if (!move_cmp(line[*len], movelist[curr_index]))
             break;
-        case _BN:
-        case _BB:
-        case _BR:
-        case _BQ:
-            ivalue -= _VALUES[(u5) (-board[y][x])];
+        if (curr_index == max_index)
+            return;
+        makemove(aux, line[*len], aux2);
+        copy_board(aux2, aux);
+        (*len)++;
+    }
+}
+
+MOVEINDEX exclude(MOVELIST movelist, MOVEINDEX max_index)
+// Drops the root moves of the variations already found in this iteration
+{
+    MOVEINDEX curr_index;
+    MOVEINDEX new_index = 0;
+    MOVEINDEX k;
+    for (curr_index = 0; curr_index < max_index; curr_index++) {
+        for (k = 0; k < gnexclude; k++)
+        if (!move_cmp(movelist[curr_index], gexclude[k]))
             break;
-        case _WK: kings++; break;
-        case _BK: kings--; break;
-        default:;
+        if (k < gnexclude)
+            continue;
+        copy_move(movelist[curr_index], movelist[new_index]);
+        new_index++;
+    }
+    return (new_index);
+}
+
+int root_illegal(BOARD start, MOVE move)
+// A multi-PV pass left with only moves that lose the king; mated lines are kept
+{
+    BOARD aux;
+    makemove(start, move, aux);
+    transpose(aux);
+    return (in_check(aux));
+}
+
+void ponder(BOARD start)
+// Pre-analyses our answers to the opponent's most likely replies.
+// `start' is the position after our move; results go to the hash table.
+{
+    BOARD next;
+    BOARD aux;
+    char buf[80];
+    char rbuf[80];
+    MOVELIST movelist;
+    VALUE valuelist[_MAXINDEX];
+    MOVEINDEX max_index;
+    MOVEINDEX curr_index;
+    MOVEINDEX k = 0;
+    if (!hashfile)
+        warn("Pondering without --hash, results will be lost");
+    max_index = gendeep(start, movelist, 1);
+    order(start, movelist, max_index, valuelist);
+    for (curr_index = 0; curr_index < max_index && k < _PONDER_K; curr_index++) {
+        makemove(start, movelist[curr_index], next);
+        copy_board(next, aux);
+        transpose(aux);
+        if (in_check(aux))
+            continue;
+        show_move(movelist[curr_index], start, stm % 2, rbuf);
+        update(&elapsed);
+        gdeadline = dclock(&elapsed) + (gtimelimit - dclock(&elapsed)) / (_PONDER_K - k);
+        stm = 1 - stm;
+        pvsready = 0;
+        treea[0].best = -_MAXVALUE;
+        treea[0].bl_len = 0;
+        VALUE best = deepen(next, gsdepth + 1, _MAXLEVEL);
+        HASHENTRY *entry = hash_probe(board_key(next));
+        if (entry) {
+            MOVE move;
+            hash_move(entry, move);
+            show_move(move, next, stm % 2, buf);
+            fprintf(stdout, "Reply: %s\n", rbuf);
+            fprintf(stdout, "Answer: %s\n", buf);
+            fprintf(stdout, "Depth: %u\n", hash_depth(entry) - goverdepth);
+            fprintf(stdout, "Evaluation: %.2lf\n", 0.01 * (double) best);
+            fprintf(stdout, "\n");
+            fflush(stdout);
         }
+        stm = 1 - stm;
+        gabort = 0;
+        k++;
     }
-    for (y = 0; y < 8; y++)
-    for (x = 0; x < 8; x++) {
-        u5 x1 = x;
-        u5 y1 = y;
-        if (x1 > 3) x1 = 7 - x1;
-        if (y1 > 3) y1 = 7 - y1;
-        if (board[y][x] < 0)
-            pvalue -= (1 + min(x1, y1));
-        else if (board[y][x] > 0)
-            pvalue += (1 + min(x1, y1));
+    gdeadline = 0;
+}
+
+VALUE search(TREE *tree_, LEVEL level, LEVEL depth)
+// level means distance from root
+// depth means 1 if treea, 0 if treeb
+{
+    BOARD aux;
+    BOARD aux2;
+    char buf[80];
+    LEVEL bl_lev;
+    LEVEL i;
+    TREE *tree;
+    TREE *ntree;
+    VALUE alpha0;
+    VALUE value;
+    u6 key = 0;
+    tree = &tree_[level];
+    gstack = !depth;
+    value = eval(tree->curr_board, level);
+    STAT(gstats.searches[!depth][level]++);
+    if (gabort)
+        return (value);
+    if (newpv)
+	tree->bl_len = 0;
+    if (value < -_THRESHOLD) {
+        return (value);
     }
-    if (kings) {
-    if (kings > 0)
-        return ( _MAXVALUE - level);
-    else
+    if (tree->depth == 0) {
+        return (value);
+    }
+    if (tree->depth <= goverdepth)
+    if (value > -(_PAWNUNIT >> 1)) {
+        return (value);
+    }
+    if (depth) {
+        key = board_key(tree->curr_board);
+        if (level)
+        if (newpv) {
+            HASHENTRY *entry = hash_probe(key);
+            STAT(gstats.hashprobes++);
+            if (entry)
+                STAT(gstats.hashhits++);
+            if (entry)
+            if (hash_depth(entry) >= tree->depth) {
+                VALUE hvalue = hash_value(entry, level);
+                switch (hash_bound(entry)) {
+                case HASH_EXACT: STAT(gstats.hashcuts++); return (hvalue);
+                case HASH_LOWER: if (hvalue >= tree->beta) { STAT(gstats.hashcuts++); return (tree->beta); } break;
+                case HASH_UPPER: if (hvalue <= tree->alpha) { STAT(gstats.hashcuts++); return (tree->alpha); } break;
+                default:;
+                }
+            }
+        }
+    }
+    if (depth)
+        glevel = level;
+    tree->max_index = gen(tree->curr_board, tree->legal_moves, depth);
+    if (tree->max_index == 0) {
         return (-_MAXVALUE + level);
     }
-    value = ivalue + pvalue;
+    if (newpv)
+	tree->bl_len = 1;
+    tree->best = -_MAXVALUE;
+    alpha0 = tree->alpha;
+    if (depth)
+    if (level == 0)
+        for (tree->curr_index = 0; tree->curr_index < tree->max_index; (tree->curr_index)++)
+            tree->valuelist[tree->curr_index] = -_MAXVALUE;
+    TREE *ntree_base = &tree_[level + 1];
+    // At the frontier the children are leaves: the first is made and scored
+    // alone, the others together once it has not cut off
+    int leaves = (tree->depth == 1) && (level > 0) && !gnnue;
+    for (tree->curr_index = 0; tree->curr_index < tree->max_index; (tree->curr_index)++) {
+        ntree = ntree_base;
+        copy_move(tree->legal_moves[tree->curr_index], tree->curr_move);
+        if (leaves) {
+            MOVEINDEX first = (tree->curr_index > 0);
+            if (tree->curr_index < 2) {
+                MOVEINDEX count = first ? tree->max_index - 1 : 1;
+                MOVEINDEX k;
+                for (k = first; k < first + count; k++)
+                    makemove(tree->curr_board, tree->legal_moves[k], frontier[!depth][k]);
+                eval_batch(&frontier[!depth][first], count, level + 1, &batch[!depth]);
+            }
+            // Same as search() on a depth 0 node
+            gstack = !depth;
+            tree->value = -eval_sibling(frontier[!depth][tree->curr_index], level + 1, \
+                batch[!depth].base[tree->curr_index - first]);
+            if (gabort)
+                return (tree->best);
+            if (newpv)
+                ntree->bl_len = 0;
+            goto scored;
+        }
+        makemove(tree->curr_board, tree->curr_move, tree->next_board);
+        copy_board(tree->next_board, ntree->curr_board);
+#ifdef _SVP
+        if (depth)
+        if (level < 1)
+        if (tree->curr_index) {
+            ntree->level = tree->level + 1;
+            ntree->depth = tree->depth - 1;
+            ntree->alpha = -(tree->alpha) - 1;
+            ntree->beta = -(tree->alpha);
+            tree->value = -search(tree_, level + 1, depth);
+            if (gabort)
+                return (tree->best);
+            tree->valuelist[tree->curr_index] = tree->value;
+            if (tree->value <= tree->alpha)
+                continue;
+            STAT(gstats.researches++);
+        }
+#endif
+        ntree->level = tree->level + 1;
+        ntree->depth = tree->depth - 1;
+        ntree->alpha = -(tree->beta);
+        ntree->beta = -(tree->alpha);
+        tree->value = -search(tree_, level + 1, depth);
+        if (gabort)
+            return (tree->best);
+scored:
+        tree->valuelist[tree->curr_index] = tree->value;
+        if (!newpv)
+            ntree->bl_len = 0;
+        newpv = 1;
+        if (tree->value > tree->best) {
+            tree->best = tree->value;
+            tree->bl_len = ntree->bl_len + 1;
+            copy_move(tree->curr_move, tree->best_line[0]);
+            if (ntree->bl_len > 0)
+            for (bl_lev = 0; bl_lev < ntree->bl_len; bl_lev++)
+                copy_move(ntree->best_line[bl_lev], \
+                    tree->best_line[bl_lev + 1]);
+            if (gjson)
+            if (depth)
+            if (level == 0)
+            if (tree->curr_index)
+                json_line("pv", tree->curr_board, tree->best, tree->best_line, tree->bl_len, \
+                    tree->depth - goverdepth, gnexclude);
+	    if (0) {
+            //if (level == 0 && depth == 1 && gmode == 4) {
+                update(&elapsed);
+                double delapsed = dclock(&elapsed);
+                copy_board(treea->curr_board, aux);
+                fprintf(stdout, "Depth: %u*\n", treea->depth - goverdepth);
+                fprintf(stdout, "Evaluation: ");
+showCI(treea->best);
+                fprintf(stdout, "\nBranching factor: %.2lf\n", pow((double) nodes, (double) 1 / (treea->depth - goverdepth)));
+                fprintf(stdout, "Best variation: ");
+                for (i = 0; i < treea->bl_len; i++) {
+                    show_move(treea->best_line[i], aux, (i + stm) % 2, buf);
+                    makemove(aux, treea->best_line[i], aux2);
+                    copy_board(aux2, aux);
+                    fprintf(stdout, "%s ", buf);
+                }
+                fprintf(stdout, "\n");
+                if (treea->bl_len & 1)
+                    transpose(aux);
+                fprintf(stdout, "Elapsed: %.2lf\n", delapsed);
+		fprintf(stdout, "NPS: %u\n", (unsigned int) ((double) nodes / delapsed));
+                fprintf(stdout, "\n");
+                fflush(stdout);
+            }
+            if (tree->best > tree->alpha)
+                tree->alpha = tree->best;
+            if (tree->alpha >= tree->beta) {
+                STAT(gstats.cutoffs[!depth][level]++);
+                if (!tree->curr_index)
+                    STAT(gstats.firstcuts[!depth][level]++);
+                if (depth)
+                if (level || !gnexclude)
+                    hash_store(key, tree->beta, tree->depth, HASH_LOWER, tree->curr_move, level);
+                return (tree->beta);
+            }
+        }
+    }
+    if (depth)
+    if (level || !gnexclude)
+        hash_store(key, tree->best, tree->depth, \
+            (tree->best > alpha0) ? HASH_EXACT : HASH_UPPER, tree->best_line[0], level);
+    return (tree->best);
+}
+
+#define abs(x) ((x > 0) ? (x) : ((-x)))
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+static inline void eval_enter(BOARD board, LEVEL level)
+// Node count, periodic time and signal checks, and the _DEBUG consistency checks
+{
+#if _DEBUG
+    BOARD aux;
+#endif
+    nodes++;
+    STAT(gstats.evals[gstack]++);
+    if (level > gseldepth)
+        gseldepth = level;
+    if (gnodelimit)
+    if (nodes >= gnodelimit)
+        gabort = 1;
+    if ((nodes % _SKIPFRAMES) == 0) {
+        if (gstop)
+            exit(0);
+        update(&elapsed);
+        double delapsed = dclock(&elapsed);
+	if (gmode == GO)
+	if (delapsed > gtimelimit)
+		exit(0);
+        if (gdeadline > 0)
+        if (delapsed > gdeadline)
+            gabort = 1;
+        if (ckptfile)
+        if (hashfile)
+        if (delapsed > ckpttime + _CKPTSECS) {
+            ckpttime = delapsed;
+            hash_save(hashfile);
+        }
+    }
+#if _DEBUG
+    copy_board(board, aux);
+    score_board(aux);
+    assert(STATE(aux)->score == STATE(board)->score);
+    assert(STATE(aux)->kings == STATE(board)->kings);
+    assert(STATE(aux)->pawnkey[0] == STATE(board)->pawnkey[0]);
+    assert(STATE(aux)->pawnkey[1] == STATE(board)->pawnkey[1]);
+    assert(board_key(board) == hash_board(board));
+    if (gnnue) {
+        static ACCUMULATOR check;
+        nnue_eval(board, level);
+        nnue_refresh(&check, board);
+        assert(!memcmp(check.v, accstack[gstack][level].v, sizeof(check.v)));
+    }
+#endif
+}
+
+static inline VALUE eval_tail(BOARD board, LEVEL level, VALUE value)
+// Check, hanging piece and noise terms on top of the static value
+{
 #if 1
     if (treea[level].depth == 1) {
-        copy_board(board, aux);
-        transpose(aux);
-        if (in_check(aux))
+        if (eval_cache(board, _EC_ECHECK))
             return (_MAXVALUE - (level + 1));
     }
     if (treea[level].depth / 2 == 1) {
-    if (in_check(board))
+    if (eval_cache(board, _EC_CHECK))
         return (-2000 + value + level);
     if (value > treea[level].alpha) {
         value = value * 10;
@@ -498,7 +1630,8 @@ VALUE eval(BOARD board, LEVEL level)
     }
 #if _OPTIMIZE
     if (value <= -50) {
-      int maxcap = genFast(board);
+      STAT(gstats.captures++);
+      int maxcap = eval_cache(board, _EC_MAXCAP);
       if (maxcap < 6)
         value += _VALUES[maxcap];
     }
@@ -507,6 +1640,7 @@ VALUE eval(BOARD board, LEVEL level)
         MOVELIST lgl_mvs;
         MOVEINDEX count = gen(board, lgl_mvs, 0);
         nodes += count;
+        STAT(gstats.captures += count);
         MOVEINDEX i;
         u4 maxcap = 0;
         for (i = 0; i < count; i++) {
@@ -521,34 +1655,99 @@ VALUE eval(BOARD board, LEVEL level)
     }
 #endif
 #endif
-    value += ((nodes & 7) - 3);
+    value += (nodes & ((1 << gnoise) - 1)) - (((1 << gnoise) - 1) >> 1);
     if (level > 1)
         return (value + (treea[level - 2].max_index - treea[level - 1].max_index));
     return (value);
 }
 
-MOVEINDEX gen(BOARD board, MOVELIST movelist, LEVEL depth)
-// depth means 1 if sortable, 0 otherwise
-// FIXME
+VALUE eval(BOARD board, LEVEL level)
 {
-    MOVEINDEX max_index = gendeep(board, movelist, 1);
-#ifdef _PVSEARCH
-    if (pvsready)
-    if (depth)
-    if (!newpv)
-    if (glevel < treea->bl_len) {
-        for (LEVEL level = 0; level < glevel; level++)
-        if (treea[level].curr_index) {
-            printf("Skip level %d\n", level);
-            fflush(stdout);
-            goto skippvs;
-        }
-        MOVE move;
+    int kings;
+    VALUE value;
+    eval_enter(board, level);
+    kings = STATE(board)->kings;
+    if (kings) {
+    if (kings > 0)
+        return ( _MAXVALUE - level);
+    else
+        return (-_MAXVALUE + level);
+    }
+    PROF(PHASES phase = prof_enter(PH_EVAL));
+    if (gnnue)
+        value = nnue_eval(board, level);
+    else
+        value = STATE(board)->score + pawns(board);
+    PROF(prof_leave(phase));
+    return (eval_tail(board, level, value));
+}
+
+void eval_batch(BOARD *boards, MOVEINDEX n, LEVEL level, EVALBATCH *batch)
+// Static value of n siblings, the part of eval() that does not depend on
+// the node count or the search window. Material and PST come incremental
+// in the state, so there is nothing here worth vectorising; the eval_tail()
+// terms run per child in eval_sibling(), which also counts the node.
+{
+    MOVEINDEX i;
+    s4 kings;
+    PROF(PHASES phase = prof_enter(PH_EVAL));
+    for (i = 0; i < n; i++) {
+        kings = STATE(boards[i])->kings;
+        if (kings)
+            batch->base[i] = (kings > 0) ? _MAXVALUE - level : -_MAXVALUE + level;
+        else
+            batch->base[i] = STATE(boards[i])->score + pawns(boards[i]);
+    }
+    PROF(prof_leave(phase));
+}
+
+VALUE eval_sibling(BOARD board, LEVEL level, VALUE base)
+// eval() with the static value taken from eval_batch()
+{
+    eval_enter(board, level);
+    if (STATE(board)->kings)
+        return (base);
+    return (eval_tail(board, level, base));
+}
+
+MOVEINDEX gen(BOARD board, MOVELIST movelist, LEVEL depth)
+// depth means 1 if sortable, 0 otherwise
+// FIXME
+{
+    PROF(PHASES phase = prof_enter(PH_GEN));
+    MOVEINDEX max_index = gendeep(board, movelist, 1);
+    PROF(prof_leave(phase));
+    STAT(gstats.gens++);
+    // The root order of the first pass, or of a checkpoint, is kept for the
+    // later multi-PV passes; they drop the moves already found
+    if (depth)
+    if (glevel == 0) {
+        if (nrootorder) {
+            memcpy(movelist, rootorder, nrootorder * sizeof(MOVE));
+            max_index = nrootorder;
+        }
+        if (gnexclude)
+            max_index = exclude(movelist, max_index);
+    }
+#ifdef _PVSEARCH
+    if (pvsready)
+    if (depth)
+    if (!newpv)
+    if (glevel < treea->bl_len) {
+        for (LEVEL level = 0; level < glevel; level++)
+        if (treea[level].curr_index) {
+            printf("Skip level %d\n", level);
+            fflush(stdout);
+            goto skippvs;
+        }
+        MOVE move;
         MOVEINDEX curr_index;
         copy_move(treea->best_line[glevel], move);
         for (curr_index = 0; curr_index < max_index; curr_index++)
         if (!move_cmp(move, movelist[curr_index]))
             break;
+        if (curr_index == max_index)
+            goto skippvs;
         copy_move(movelist[0], movelist[curr_index]);
         copy_move(move, movelist[0]);
         return max_index;
@@ -557,57 +1756,77 @@ skippvs:
 #endif
     if (!depth)
         return max_index;
+    if (glevel == 0)
+    if (nrootorder)
+        return max_index;
 #ifdef _SORT
-    if (glevel < gdepth - _S_DEPTH - 1) {
+    if (glevel < gdepth - gsdepth - 1) {
         MOVEINDEX curr_index;
-        MOVEINDEX ncurr_index;
         VALUE valuelist[_MAXINDEX];
-        for (curr_index = 0; curr_index < max_index; curr_index++) {
-            BOARD aux;
-            MOVE move;
-            copy_move(movelist[curr_index], move);
-            makemove(board, move, aux);
-            copy_board(aux, treeb[0].curr_board);
-            treeb[0].level = 0;
-            LEVEL _s_depth = _S_DEPTH;
-            treeb[0].depth = _s_depth;
-            treeb[0].alpha = _ALPHA_DFL;
-            treeb[0].beta = _BETA_DFL;
-            valuelist[curr_index] = -search(treeb, 0, 0);
-        }
-        for (curr_index = 0; curr_index < max_index; curr_index++)
-        for (ncurr_index = curr_index + 1; ncurr_index < max_index; ncurr_index++) {
-            if (valuelist[ncurr_index] > valuelist[curr_index]) {
-            MOVE move;
-            VALUE value;
-            copy_move(movelist[ncurr_index], move);
-            copy_move(movelist[curr_index], movelist[ncurr_index]);
-            copy_move(move, movelist[curr_index]);
-            value = valuelist[ncurr_index];
-            valuelist[ncurr_index] = valuelist[curr_index];
-            valuelist[curr_index] = value;
-        }
-    }
-#ifdef _CAND7
+        order(board, movelist, max_index, valuelist);
     LEVEL newmax_index = max_index;
     if (glevel)
-        newmax_index = 6;
+    if (gcandwidth)
+        newmax_index = gcandwidth;
     if (max_index > newmax_index)
         max_index = newmax_index;
-#endif
-#ifdef _CAND250
     if (glevel)
+    if (gcandcut)
     for (curr_index = 0; curr_index < max_index; curr_index++)
-    if (valuelist[curr_index] < valuelist[0] - _CANDCUT) {
+    if (valuelist[curr_index] < valuelist[0] - gcandcut) {
         max_index = curr_index;
         break;
     }
-#endif
     }
 #endif
+    if (glevel == 0) {
+        // Moves played in the database lead; the sort is stable, so each
+        // group keeps the order found above
+        if (gdb)
+            db_order(board, movelist, max_index);
+        if (!nrootorder) {
+            memcpy(rootorder, movelist, max_index * sizeof(MOVE));
+            nrootorder = max_index;
+        }
+    }
     return max_index;
 }
 
+void order(BOARD board, MOVELIST movelist, MOVEINDEX max_index, VALUE *valuelist)
+// Sorts moves by the score of a gsdepth search in treeb
+{
+    MOVEINDEX curr_index;
+    MOVEINDEX ncurr_index;
+    PROF(PHASES phase = prof_enter(PH_ORDER));
+    for (curr_index = 0; curr_index < max_index; curr_index++) {
+        BOARD aux;
+        MOVE move;
+        copy_move(movelist[curr_index], move);
+        makemove(board, move, aux);
+        copy_board(aux, treeb[0].curr_board);
+        treeb[0].level = 0;
+        LEVEL _s_depth = gsdepth;
+        treeb[0].depth = _s_depth;
+        treeb[0].alpha = _ALPHA_DFL;
+        treeb[0].beta = _BETA_DFL;
+        valuelist[curr_index] = -search(treeb, 0, 0);
+    }
+    for (curr_index = 0; curr_index < max_index; curr_index++)
+    for (ncurr_index = curr_index + 1; ncurr_index < max_index; ncurr_index++) {
+        if (valuelist[ncurr_index] > valuelist[curr_index]) {
+            MOVE move;
+            VALUE value;
+            copy_move(movelist[ncurr_index], move);
+            copy_move(movelist[curr_index], movelist[ncurr_index]);
+            copy_move(move, movelist[curr_index]);
+            value = valuelist[ncurr_index];
+            valuelist[ncurr_index] = valuelist[curr_index];
+            valuelist[curr_index] = value;
+        }
+    }
+    PROF(prof_leave(phase));
+}
+
 void addm(s5 y, s5 x, s5 y1, s5 x1, MOVEINDEX *curr_index, MOVELIST movelist)
 {
     movelist[*curr_index][0] = y;
@@ -639,7 +1858,7 @@ void castle(BOARD board, s5 y, s5 x, MOVEINDEX *curr_index, MOVELIST movelist)
     if (board[y][x] != _WK)
         return;
     
-#if _CHESS960==0
+    if (!gchess960) {
     // Standard chess castling
     if (board[0][0] == _WR)
     if (board[0][1] == 0)
@@ -662,7 +1881,8 @@ void castle(BOARD board, s5 y, s5 x, MOVEINDEX *curr_index, MOVELIST movelist)
         if (! in_check(aux))
             addm(0, 4, 0, 6, curr_index, movelist);
     }
-#else
+    return;
+    }
     // Chess960 castling logic
     s5 i, rook_x;
     
@@ -707,7 +1927,6 @@ void castle(BOARD board, s5 y, s5 x, MOVEINDEX *curr_index, MOVELIST movelist)
             }
         }
     }
-#endif
 }
 
 void genP(BOARD board, s5 y, s5 x, MOVEINDEX *curr_index, MOVELIST movelist)
@@ -744,6 +1963,14 @@ void genP(BOARD board, s5 y, s5 x, MOVEINDEX *curr_index, MOVELIST movelist)
                 addprom(y, x, y + 1, x + 1, to, curr_index, movelist);
         }
     }
+    if (y == 4)
+    if (STATE(board)->ep) {
+        s5 ep = STATE(board)->ep - 1;
+        if (x == ep - 1 || x == ep + 1)
+        if (board[5][ep] == 0)
+        if (board[4][ep] == _BP)
+            addm(y, x, y + 1, ep, curr_index, movelist);
+    }
 }
 
 void genN(BOARD board, s5 y, s5 x, MOVEINDEX *curr_index, MOVELIST movelist)
@@ -979,19 +2206,37 @@ double dclock(ELAPSED *elapsed)
 }
 
 int board_cmp(BOARD src, BOARD dest)
+// Squares, castling rights and en passant; the rest of BSTATE follows from them
 {
-    u5 x;
-    u5 y;
-    for (y = 0; y < 9; y++)
-    for (x = 0; x < 8; x++)
-    if (dest[y][x] != src[y][x])
+    u5 a;
+    u5 b;
+    memcpy(&a, STATE(src)->castle, sizeof(a));
+    memcpy(&b, STATE(dest)->castle, sizeof(b));
+    if (a != b)
         return (1);
-    return (0);
+    if (STATE(src)->ep != STATE(dest)->ep)
+        return (1);
+#if defined(__AVX2__)
+    __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) &src[0][0]), \
+        _mm256_loadu_si256((__m256i *) &dest[0][0]));
+    __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) &src[4][0]), \
+        _mm256_loadu_si256((__m256i *) &dest[4][0]));
+    return (!_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi)));
+#else
+    return (memcmp(src, dest, 64) != 0);
+#endif
 }
 
 void copy_board(BOARD src, BOARD dest)
 {
+#if defined(__AVX2__)
+    u5 u;
+    for (u = 0; u < sizeof(BOARD); u += 32)
+        _mm256_storeu_si256((__m256i *) ((int8_t *) dest + u), \
+            _mm256_loadu_si256((__m256i *) ((int8_t *) src + u)));
+#else
     memcpy(dest, src, sizeof(BOARD));
+#endif
 }
 
 void copy_move(MOVE src, MOVE dest)
@@ -1033,9 +2278,11 @@ void load(BOARD board)
     }
     for (x = 0; x < 8; x++)
         board[8][x] = (x < 4);
+    score_board(board);
     fscanf(f, "%d", &stm);
     fclose(f);
-    show_board(board, stdout);
+    if (!gjson)
+        show_board(board, stdout);
     if (stm)
         transpose(board);
 }
@@ -1070,6 +2317,7 @@ s4 in_check(BOARD board)
     MOVEINDEX curr_index;
     MOVEINDEX max_index;
     MOVELIST movelist;
+    STAT(gstats.checks++);
     copy_board(board, aux);
     transpose(aux);
     max_index = gendeep(aux, movelist, 0);
@@ -1081,20 +2329,56 @@ s4 in_check(BOARD board)
     return (0);
 }
 
+static inline void put(BOARD board, u5 y, u5 x, s3 piece)
+// Sets a square and keeps the row 8 totals in step
+{
+    s3 old = board[y][x];
+    STATE(board)->score += psqt[piece + 6][(y << 3) | x] - psqt[old + 6][(y << 3) | x];
+    STATE(board)->kings += (piece == _WK) - (piece == _BK) - (old == _WK) + (old == _BK);
+    STATE(board)->key[0] ^= zobrist[old + 6][(y << 3) | x] ^ zobrist[piece + 6][(y << 3) | x];
+    STATE(board)->key[1] ^= zobrist[6 - old][((y << 3) | x) ^ 56] ^ zobrist[6 - piece][((y << 3) | x) ^ 56];
+    if (old == _WP || old == _BP) {
+        STATE(board)->pawnkey[0] ^= zobrist_pawn[old < 0][(y << 3) | x];
+        STATE(board)->pawnkey[1] ^= zobrist_pawn[old > 0][((y << 3) | x) ^ 56];
+    }
+    if (piece == _WP || piece == _BP) {
+        STATE(board)->pawnkey[0] ^= zobrist_pawn[piece < 0][(y << 3) | x];
+        STATE(board)->pawnkey[1] ^= zobrist_pawn[piece > 0][((y << 3) | x) ^ 56];
+    }
+    for (u5 d = 0; d < 4; d++)
+    if (!STATE(board)->dirty[d]) {
+        STATE(board)->dirty[d] = 1 + (((y << 3) | x) | ((old + 6) << 6) | ((piece + 6) << 10));
+        break;
+    }
+    board[y][x] = piece;
+}
+
 void makemove(BOARD src, MOVE move, BOARD dest)
 {
     copy_board(src, dest);
+    memset(STATE(dest)->dirty, 0, sizeof(STATE(dest)->dirty));
+    STATE(dest)->ep = 0;
+    if (dest[(u5) move[2]][(u5) move[3]] || dest[(u5) move[0]][(u5) move[1]] == _WP)
+        STATE(dest)->halfmove = 0;
+    else if (STATE(dest)->halfmove < 255)
+        STATE(dest)->halfmove++;
+    if (move[2] == 7) {
+        if (move[3] == 0)
+        dest[8][2] = 0;
+        if (move[3] == 7)
+        dest[8][3] = 0;
+    }
     if (dest[(u5) move[0]][(u5) move[1]] == _WK) {
         if (move[0] == 0)
         if (move[2] == 0)
         if (move[1] == 4) {
         if (move[3] == 2) {
-            dest[0][0] = 0;
-            dest[0][3] = _WR;
+            put(dest, 0, 0, 0);
+            put(dest, 0, 3, _WR);
         }
         if (move[3] == 6) {
-            dest[0][7] = 0;
-            dest[0][5] = _WR;
+            put(dest, 0, 7, 0);
+            put(dest, 0, 5, _WR);
         }
         }
         dest[8][0] = 0;
@@ -1109,18 +2393,24 @@ void makemove(BOARD src, MOVE move, BOARD dest)
     }
     if (dest[(u5) move[0]][(u5) move[1]] == _WP)
     if (move[0] == 6) {
-        dest[(u5) move[2]][(u5) move[3]] = move[4] ? (u5) move[4] : _WQ;
-        dest[(u5) move[0]][(u5) move[1]] = 0;
+        put(dest, move[2], move[3], move[4] ? (u5) move[4] : _WQ);
+        put(dest, move[0], move[1], 0);
         transpose(dest);
         goto end;
     }
     if (dest[(u5) move[0]][(u5) move[1]] == _WP)
     if (move[0] == 4)
     if (move[1] != move[3])
+    if (dest[(u5) move[2]][(u5) move[3]] == 0)
     if (dest[(u5) move[0]][(u5) move[3]] == _BP)
-        dest[(u5) move[0]][(u5) move[3]] = 0;
-    dest[(u5) move[2]][(u5) move[3]] = dest[(u5) move[0]][(u5) move[1]];
-    dest[(u5) move[0]][(u5) move[1]] = 0;
+        put(dest, move[0], move[3], 0);
+    if (dest[(u5) move[0]][(u5) move[1]] == _WP)
+    if (move[0] == 1)
+    if (move[2] == 3)
+    if ((move[3] > 0 && dest[3][move[3] - 1] == _BP) || (move[3] < 7 && dest[3][move[3] + 1] == _BP))
+        STATE(dest)->ep = move[3] + 1;
+    put(dest, move[2], move[3], dest[(u5) move[0]][(u5) move[1]]);
+    put(dest, move[0], move[1], 0);
     transpose(dest);
 end:    ;
 }
@@ -1218,25 +2508,49 @@ void show_board(BOARD board, FILE *f)
 }
 
 void transpose(BOARD board)
+// Ranks reversed and colours negated, so the side to move plays up the board
 {
-    s3 t;
+    BSTATE *st = STATE(board);
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_loadu_si256((__m256i *) &board[0][0]);
+    __m256i hi = _mm256_loadu_si256((__m256i *) &board[4][0]);
+    _mm256_storeu_si256((__m256i *) &board[0][0], \
+        _mm256_sub_epi8(zero, _mm256_permute4x64_epi64(hi, 0x1b)));
+    _mm256_storeu_si256((__m256i *) &board[4][0], \
+        _mm256_sub_epi8(zero, _mm256_permute4x64_epi64(lo, 0x1b)));
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i r[4];
+    u5 u;
+    for (u = 0; u < 4; u++)
+        r[u] = _mm_loadu_si128((__m128i *) &board[2 * u][0]);
+    for (u = 0; u < 4; u++)
+        _mm_storeu_si128((__m128i *) &board[2 * u][0], \
+            _mm_sub_epi8(zero, _mm_shuffle_epi32(r[3 - u], 0x4e)));
+#else
+    int8_t t;
     u5 x;
     u5 y;
     for (y = 0; y < 4; y++)
     for (x = 0; x < 8; x++) {
         t = board[y][x];
-        board[y][x] = board[7 - y][x];
-        board[7 - y][x] = t;
+        board[y][x] = -board[7 - y][x];
+        board[7 - y][x] = -t;
     }
-    for (y = 0; y < 8; y++)
-    for (x = 0; x < 8; x++)
-        board[y][x] = -board[y][x];
-    t = board[8][0];
-    board[8][0] = board[8][2];
-    board[8][2] = t;
-    t = board[8][1];
-    board[8][1] = board[8][3];
-    board[8][3] = t;
+#endif
+    u5 castle;
+    memcpy(&castle, st->castle, sizeof(castle));
+    castle = (castle >> 16) | (castle << 16);
+    memcpy(st->castle, &castle, sizeof(castle));
+    st->kings = -st->kings;
+    st->score = -st->score;
+    u5 pk = st->pawnkey[0];
+    st->pawnkey[0] = st->pawnkey[1];
+    st->pawnkey[1] = pk;
+    u6 k = st->key[0];
+    st->key[0] = st->key[1];
+    st->key[1] = k;
 }
 
 void setup_board(BOARD board)
@@ -1257,6 +2571,7 @@ void setup_board(BOARD board)
 		fflush(stdin);
 		switch(symbol) {
 			case 4: 
+				score_board(board);
 				return;
 				break;
 			case 20: board[y][x] = 0; break;
@@ -1307,7 +2622,6 @@ void setup_board(BOARD board)
 				break;
 			case 73:
 				stm = 1 - stm;
-				board[8][4] = stm;
 				break;
 			case 74:
 				exit(0);
@@ -1331,30 +2645,482 @@ void load_values(void)
     _VALUES[3] = 325;
     _VALUES[4] = 500;
     _VALUES[5] = 980;
+    if (valuesfile)
+        load_params(valuesfile);
+    init_psqt();
+}
+
+void load_params(const char *name)
+// "key value" lines; a plain .bpf file sets the piece values
+{
+    FILE *f;
+    char key[32];
+    s5 value;
+    u5 i;
+    f = fopen(name, "r");
+    if (!f) {
+        warn("Cannot open values file");
+        exit(1);
+    }
+    while (fscanf(f, "%31s %d", key, &value) == 2) {
+        for (i = 0; i < _NPARAMS; i++)
+        if (!strcmp(key, params[i].name)) {
+            *params[i].value = value;
+            break;
+        }
+        if (i == _NPARAMS)
+        if (!set_param(key, value))
+            warn("Unknown key in values file");
+    }
+    fclose(f);
+}
+
+int set_param(const char *name, s5 value)
+// Search parameters, by name; returns 0 if there is none
+{
+    u5 i;
+    for (i = 0; i < _NSPARAMS; i++)
+    if (!strcmp(name, sparams[i].name)) {
+        *sparams[i].value = value;
+        return (1);
+    }
+    return (0);
+}
+
+void save_params(const char *name)
+{
+    FILE *f;
+    char tmp[4096];
+    u5 i;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    f = fopen(tmp, "w");
+    if (!f) {
+        warn("Cannot open values file for write");
+        return;
+    }
+    for (i = 0; i < _NPARAMS; i++)
+        fprintf(f, "%s %d\n", params[i].name, *params[i].value);
+    for (i = 0; i < _NSPARAMS; i++)
+        fprintf(f, "%s %d\n", sparams[i].name, *sparams[i].value);
+    fclose(f);
+    if (rename(tmp, name))
+        warn("Cannot rename values file");
+}
+
+void init_psqt(void)
+// Material and centralisation of every piece on every square, for put()
+{
+    u5 p;
+    u5 sq;
+    for (sq = 0; sq < 64; sq++) {
+        psqt[6][sq] = 0;
+        for (p = 1; p <= 6; p++) {
+            VALUE v = _CENTRE[sq];
+            if (p == _WP)
+                v += _PAWNRANK[sq >> 3];
+            else if (p != _WK)
+                v += _VALUES[p];
+            psqt[6 + p][sq] = v;
+            psqt[6 - p][sq ^ 56] = -v;
+        }
+    }
+}
+
+void score_board(BOARD board)
+{
+    u5 x;
+    u5 y;
+    STATE(board)->score = 0;
+    STATE(board)->kings = 0;
+    u6 keys[2] = { 0, 0 };
+    STATE(board)->pawnkey[0] = 0;
+    STATE(board)->pawnkey[1] = 0;
+    for (y = 0; y < 8; y++)
+    for (x = 0; x < 8; x++) {
+        s3 piece = board[y][x];
+        keys[0] ^= zobrist[piece + 6][(y << 3) | x];
+        keys[1] ^= zobrist[6 - piece][((y << 3) | x) ^ 56];
+        STATE(board)->score += psqt[piece + 6][(y << 3) | x];
+        STATE(board)->kings += (piece == _WK) - (piece == _BK);
+        if (piece == _WP || piece == _BP) {
+            STATE(board)->pawnkey[0] ^= zobrist_pawn[piece < 0][(y << 3) | x];
+            STATE(board)->pawnkey[1] ^= zobrist_pawn[piece > 0][((y << 3) | x) ^ 56];
+        }
+    }
+    memcpy(STATE(board)->key, keys, sizeof(keys));
+    memset(STATE(board)->dirty, 0, sizeof(STATE(board)->dirty));
+}
+
+VALUE pawns(BOARD board)
+// Pawn structure for the side to move, computed once per pawn configuration
+{
+    BOARD aux;
+    u5 key = (u5) STATE(board)->pawnkey[0];
+    PAWNENTRY *entry = &pawntable[key & ((1 << _PAWNBITS) - 1)];
+    if (entry->key == key)
+        return (entry->value);
+    copy_board(board, aux);
+    transpose(aux);
+    entry->key = key;
+    entry->value = pawn_side(board) - pawn_side(aux);
+    return (entry->value);
+}
+
+void pawn_terms(BOARD board, s4 *terms)
+// Counts for White: passed pawns by rank in 0..7, then isolated, backward, doubled
+{
+    s5 count[10] = { 0 };
+    s5 wmin[10];
+    s5 bmax[10];
+    s5 x;
+    s5 y;
+    // Files are shifted by one so that x - 1 and x + 1 are always valid
+    for (x = 0; x < 10; x++) {
+        wmin[x] = 8;
+        bmax[x] = -1;
+    }
+    for (y = 1; y < 7; y++)
+    for (x = 0; x < 8; x++) {
+        if (board[y][x] == _WP) {
+            count[x + 1]++;
+            if (y < wmin[x + 1])
+                wmin[x + 1] = y;
+        } else if (board[y][x] == _BP) {
+            if (y > bmax[x + 1])
+                bmax[x + 1] = y;
+        }
+    }
+    for (y = 1; y < 7; y++)
+    for (x = 1; x < 9; x++) {
+        if (board[y][x - 1] != _WP)
+            continue;
+        if (bmax[x - 1] <= y && bmax[x] <= y && bmax[x + 1] <= y)
+            terms[y]++;
+        if (!count[x - 1] && !count[x + 1])
+            terms[8]++;
+        else if (wmin[x - 1] > y && wmin[x + 1] > y)
+        if (y < 6)
+        if ((x > 1 && board[y + 2][x - 2] == _BP) || (x < 8 && board[y + 2][x] == _BP))
+            terms[9]++;
+    }
+    for (x = 1; x < 9; x++)
+    if (count[x] > 1)
+        terms[10] += count[x] - 1;
+}
+
+VALUE pawn_side(BOARD board)
+// Passed, isolated, doubled and backward white pawns
+{
+    s4 terms[11] = { 0 };
+    VALUE value = 0;
+    s5 y;
+    pawn_terms(board, terms);
+    for (y = 1; y < 7; y++)
+        value += terms[y] * _PASSED[y];
+    return (value - terms[8] * _ISOLATED - terms[9] * _BACKWARD - terms[10] * _DOUBLED);
+}
+
+void on_signal(int sig)
+{
+    gstop = 1;
+}
+
+void hash_exit(void)
+{
+    if (hashfile)
+        hash_save(hashfile);
 }
 
 int main_ANALYSIS(void) {
     srand(time(NULL));
+    if (gjson)
+        json_open();
     load_values();
+    hash_init();
+    if (nnuefile)
+        gnnue = nnue_load(nnuefile);
+    if (dbfile)
+        db_open(dbfile);
+    if (hashfile) {
+        hash_load(hashfile);
+        atexit(hash_exit);
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        signal(SIGXCPU, on_signal);
+    }
     return analysis();
 }
 
+int main_SPSA(void) {
+    load_values();
+    hash_init();
+    return spsa();
+}
+
+int main_DATAGEN(void) {
+    load_values();
+    hash_init();
+    if (nnuefile)
+        gnnue = nnue_load(nnuefile);
+    return datagen(datafile, pgnfiles, npgnfiles);
+}
+
+int main_DATADUMP(void) {
+    load_values();
+    hash_init();
+    return datadump(datafile);
+}
+
+int main_BATCH(void) {
+    load_values();
+    hash_init();
+    if (nnuefile)
+        gnnue = nnue_load(nnuefile);
+    if (dbfile)
+        db_open(dbfile);
+    if (hashfile) {
+        hash_load(hashfile);
+        atexit(hash_exit);
+    }
+    return epd_batch(batchfile);
+}
+
+int main_BENCH(void) {
+    load_values();
+    hash_init();
+    if (nnuefile)
+        gnnue = nnue_load(nnuefile);
+    return bench(gmaxdepth);
+}
+
+int main_MICRO(void) {
+    load_values();
+    hash_init();
+    return micro();
+}
+
+int main_UCI(void) {
+    setvbuf(stdin, NULL, _IOLBF, 0);
+    load_values();
+    hash_init();
+    if (nnuefile)
+        gnnue = nnue_load(nnuefile);
+    if (dbfile)
+        db_open(dbfile);
+    return uci();
+}
+
+int main_DBBUILD(void) {
+    load_values();
+    hash_init();
+    return dbbuild(dbfile, pgnfiles, npgnfiles);
+}
+
+int main_SERVE(void) {
+    load_values();
+    hash_init();
+    if (nnuefile)
+        gnnue = nnue_load(nnuefile);
+    if (dbfile)
+        db_open(dbfile);
+    if (hashfile) {
+        hash_load(hashfile);
+        atexit(hash_exit);
+    }
+    return serve(sockfile);
+}
+
+int main_PGNFILTER(void) {
+    load_values();
+    hash_init();
+    return pgnfilter(pgnfiles, npgnfiles);
+}
+
+int main_DBQUERY(void) {
+    load_values();
+    hash_init();
+    if (!db_open(dbfile ? dbfile : _DBFILE))
+        return (1);
+    return dbquery(gfen);
+}
+
+int main_TUNE(void) {
+    load_values();
+    hash_init();
+    return tune(tunefile);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        gmode = ANALYSIS;
-    } else if (argc == 2) {
-        if (!strcmp(argv[1], "analyze")) {
+    int i;
+    gmode = ANALYSIS;
+    treea = trees[0];
+    treeb = trees[1];
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "analyze")) {
             gmode = ANALYSIS;
-	} else if (!strcmp(argv[1], "go")) {
+	} else if (!strcmp(argv[i], "go")) {
             gmode = GO;
-	} else if (!strcmp(argv[1], "eval")) {
+	} else if (!strcmp(argv[i], "eval")) {
             gmode = EVAL;
+	} else if (!strcmp(argv[i], "ponder")) {
+            gmode = PONDER;
+	} else if (!strcmp(argv[i], "--multipv") && i + 1 < argc) {
+            gmultipv = atoi(argv[++i]);
+            if (gmultipv < 1)
+                gmultipv = 1;
+            if (gmultipv > _MAXMULTIPV)
+                gmultipv = _MAXMULTIPV;
+	} else if (!strcmp(argv[i], "--time") && i + 1 < argc) {
+            gtimelimit = atof(argv[++i]);
+	} else if (!strcmp(argv[i], "resume") && i + 1 < argc) {
+            ckptfile = argv[++i];
+            gresume = 1;
+	} else if (!strcmp(argv[i], "--hash") && i + 1 < argc) {
+            hashfile = argv[++i];
+	} else if (!strcmp(argv[i], "tune") && i + 1 < argc) {
+            gmode = TUNE;
+            tunefile = argv[++i];
+	} else if (!strcmp(argv[i], "--fen") && i + 1 < argc) {
+            gfen = argv[++i];
+            ginput = INPUT_FEN;
+	} else if (!strcmp(argv[i], "--pgn") && i + 1 < argc) {
+            gpgn = argv[++i];
+            ginput = INPUT_PGN;
+	} else if (!strcmp(argv[i], "--brd")) {
+            ginput = INPUT_BRD;
+	} else if (!strcmp(argv[i], "--print-fen")) {
+            gprintfen = 1;
+	} else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+            gwindow = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+            gmaxdepth = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "--chess960")) {
+            gchess960 = 1;
+	} else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            if (!freopen(argv[++i], "w", stdout)) {
+                warn("Cannot open output file");
+                return (1);
+            }
+	} else if (!strcmp(argv[i], "--json")) {
+            gjson = 1;
+	} else if (!strcmp(argv[i], "serve")) {
+            gmode = SERVE;
+            sockfile = _SOCKFILE;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                sockfile = argv[++i];
+	} else if (!strcmp(argv[i], "bench")) {
+            gmode = BENCH;
+            gmaxdepth = _BENCH_DEPTH;
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+                gmaxdepth = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "micro")) {
+            gmode = MICRO;
+	} else if (!strcmp(argv[i], "uci")) {
+            gmode = UCI;
+	} else if (!strcmp(argv[i], "batch")) {
+            gmode = BATCH;
+            batchfile = "-";
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || !strcmp(argv[i + 1], "-")))
+                batchfile = argv[++i];
+	} else if (!strcmp(argv[i], "dbbuild") && i + 2 < argc) {
+            gmode = DBBUILD;
+            dbfile = argv[++i];
+            pgnfiles = &argv[i + 1];
+            for (npgnfiles = 0; i + 1 < argc && argv[i + 1][0] != '-'; npgnfiles++)
+                i++;
+	} else if (!strcmp(argv[i], "pgnfilter") && i + 1 < argc) {
+            gmode = PGNFILTERING;
+            pgnfiles = &argv[i + 1];
+            for (npgnfiles = 0; i + 1 < argc && argv[i + 1][0] != '-'; npgnfiles++)
+                i++;
+	} else if (!strcmp(argv[i], "--player") && i + 1 < argc) {
+            pgnf.player = argv[++i];
+	} else if (!strcmp(argv[i], "--white") && i + 1 < argc) {
+            pgnf.white = argv[++i];
+	} else if (!strcmp(argv[i], "--black") && i + 1 < argc) {
+            pgnf.black = argv[++i];
+	} else if (!strcmp(argv[i], "--event") && i + 1 < argc) {
+            pgnf.event = argv[++i];
+	} else if (!strcmp(argv[i], "--elo") && i + 1 < argc) {
+            pgnf.elomax = 9999;
+            sscanf(argv[++i], "%d-%d", &pgnf.elomin, &pgnf.elomax);
+	} else if (!strcmp(argv[i], "--result") && i + 1 < argc) {
+            pgnf.result = argv[++i];
+	} else if (!strcmp(argv[i], "--position") && i + 1 < argc) {
+            if (pgnf.npos < _PGNF_MAXPOS)
+                pgnf.fen[pgnf.npos++] = argv[i + 1];
+            i++;
+	} else if (!strcmp(argv[i], "dbquery") && i + 1 < argc) {
+            gmode = DBQUERY;
+            gfen = argv[++i];
+	} else if (!strcmp(argv[i], "--db") && i + 1 < argc) {
+            dbfile = argv[++i];
+	} else if (!strcmp(argv[i], "--db-mem") && i + 1 < argc) {
+            gdbmem = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "datagen") && i + 1 < argc) {
+            gmode = DATAGEN;
+            datafile = argv[++i];
+            pgnfiles = &argv[i + 1];
+            for (npgnfiles = 0; i + 1 < argc && argv[i + 1][0] != '-'; npgnfiles++)
+                i++;
+	} else if (!strcmp(argv[i], "datadump") && i + 1 < argc) {
+            gmode = DATADUMP;
+            datafile = argv[++i];
+	} else if (!strcmp(argv[i], "spsa")) {
+            gmode = SPSA;
+	} else if (!strcmp(argv[i], "--nodes") && i + 1 < argc) {
+            gnodelimit = strtoull(argv[++i], NULL, 10);
+	} else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            giterations = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "--games") && i + 1 < argc) {
+            ggames = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "--book") && i + 1 < argc) {
+            bookfile = argv[++i];
+	} else if (!strcmp(argv[i], "--param") && i + 1 < argc) {
+            char name[32];
+            s5 value;
+            if (sscanf(argv[++i], "%31[^=]=%d", name, &value) != 2 || !set_param(name, value))
+                warn("Unknown search parameter");
+	} else if (!strcmp(argv[i], "--values") && i + 1 < argc) {
+            valuesfile = argv[++i];
+	} else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            outfile = argv[++i];
+	} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            gthreads = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "--nnue") && i + 1 < argc) {
+            nnuefile = argv[++i];
+	} else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            ckptfile = argv[++i];
         } else {
             gmode = NONE;
 	}
-    } else {
-        gmode = NONE;
     }
+    if (gmode == TUNE)
+        return main_TUNE();
+    if (gmode == SPSA)
+        return main_SPSA();
+    if (gmode == DATAGEN)
+        return main_DATAGEN();
+    if (gmode == DATADUMP)
+        return main_DATADUMP();
+    if (gmode != ANALYSIS && gmode != GO && gmode != EVAL && gmode != PONDER)
+        gjson = 0;
+    if (gmode == BATCH)
+        return main_BATCH();
+    if (gmode == DBBUILD)
+        return main_DBBUILD();
+    if (gmode == DBQUERY)
+        return main_DBQUERY();
+    if (gmode == PGNFILTERING)
+        return main_PGNFILTER();
+    if (gmode == BENCH)
+        return main_BENCH();
+    if (gmode == MICRO)
+        return main_MICRO();
+    if (gmode == UCI)
+        return main_UCI();
+    if (gmode == SERVE)
+        return main_SERVE();
     return main_ANALYSIS();
 }
 
@@ -1363,98 +3129,3554 @@ void warn(const char *msg)
     fprintf(stderr, "\nwarn %s\n", msg);
 }
 
-void parse_fen(BOARD board) {
-  FILE *f;
-  int x = 1;
-  int y = 8;
-  int ch;
-  int pp;
-  f = fopen("start.fen", "r");
-  if (!f)
-    warn("warn in parse_fen"); // Make sure 'warn' is defined
-  while ((ch = fgetc(f)) != EOF && ch != ' ') {
-    pp = 0;
-    if ((ch >= '1') && (ch <= '8')) {
-      while (ch > '0') {
-        board[y - 1][x - 1] = 0;
-        x++;
-        ch--;
-      }
-      if (x == 9) {
-        x = 1;
-        y--;
-        if (!y) {
-	  ch = fgetc(f);
-          goto end;
-	}
-        continue;
-      }
-    } else if (ch != '/') {
-      switch (ch) {
-        case 'p': pp = -1; break;
-        case 'n': pp = -2; break;
-        case 'b': pp = -3; break;
-        case 'r': pp = -4; break;
-        case 'q': pp = -5; break;
-        case 'k': pp = -6; break;
-        case 'P': pp = 1; break;
-        case 'N': pp = 2; break;
-        case 'B': pp = 3; break;
-        case 'R': pp = 4; break;
-        case 'Q': pp = 5; break;
-        case 'K': pp = 6; break;
-        default: pp = -8;
-      }
-      if (pp > -8)
-        board[y - 1][x - 1] = pp;
-      x++;
-      if (x == 9) {
-        x = 1;
-        y--;
-        if (!y) {
-          ch = fgetc(f);
-          goto end;
-        }
-      }
+int fen_board(const char *fen, BOARD board, s5 *side, s5 *moveno)
+// A FEN string, White at the bottom. Castling, en passant and the move
+// counters are optional: without them every castling right is kept, as in
+// EPD files that only give the placement and side. Returns 0 if the string
+// is not a position.
+{
+    s5 x = 0;
+    s5 y = 7;
+    s3 pp;
+    s5 king[2] = { 4, 4 };
+    for (; *fen && *fen != ' '; fen++) {
+        if (*fen >= '1' && *fen <= '8') {
+            for (pp = *fen - '0'; pp > 0; pp--)
+            if (x < 8 && y >= 0)
+                board[y][x++] = 0;
+            continue;
+        }
+        if (*fen == '/') {
+            if (x != 8)
+                return (0);
+            x = 0;
+            y--;
+            continue;
+        }
+        switch (*fen) {
+        case 'p': pp = _BP; break;
+        case 'n': pp = _BN; break;
+        case 'b': pp = _BB; break;
+        case 'r': pp = _BR; break;
+        case 'q': pp = _BQ; break;
+        case 'k': pp = _BK; break;
+        case 'P': pp = _WP; break;
+        case 'N': pp = _WN; break;
+        case 'B': pp = _WB; break;
+        case 'R': pp = _WR; break;
+        case 'Q': pp = _WQ; break;
+        case 'K': pp = _WK; break;
+        default: return (0);
+        }
+        if (x > 7 || y < 0)
+            return (0);
+        if (pp == _WK && y == 0)
+            king[0] = x;
+        if (pp == _BK && y == 7)
+            king[1] = x;
+        board[y][x++] = pp;
     }
-  }
+    if (y != 0 || x != 8 || *fen != ' ')
+        return (0);
+    fen++;
+    if (*fen == 'w')
+        *side = 0;
+    else if (*fen == 'b')
+        *side = 1;
+    else
+        return (0);
+    fen++;
+    if (moveno)
+        *moveno = 1;
+    for (x = 0; x < 8; x++)
+        board[8][x] = 0;
+    score_board(board);
+    while (*fen == ' ')
+        fen++;
+    if (!*fen || *fen == '\n' || *fen == '\r') {
+        for (x = 0; x < 4; x++)
+            board[8][x] = 1;
+        return (1);
+    }
+    // Castling: KQkq, or the rook files of Shredder-FEN
+    for (; *fen && *fen != ' '; fen++)
+    switch (*fen) {
+    case 'K': board[8][1] = 1; break;
+    case 'Q': board[8][0] = 1; break;
+    case 'k': board[8][3] = 1; break;
+    case 'q': board[8][2] = 1; break;
+    case '-': break;
+    default:
+        if (*fen >= 'A' && *fen <= 'H')
+            board[8][(*fen - 'A') > king[0]] = 1;
+        else if (*fen >= 'a' && *fen <= 'h')
+            board[8][2 + ((*fen - 'a') > king[1])] = 1;
+        else
+            return (0);
+    }
+    while (*fen == ' ')
+        fen++;
+    // Kept only if a pawn can take, so that equal positions get equal keys
+    if (*fen >= 'a' && *fen <= 'h' && (fen[1] == '3' || fen[1] == '6')) {
+        x = *fen - 'a';
+        y = *side ? 3 : 4;
+        pp = *side ? _BP : _WP;
+        if (board[y][x] == -pp)
+        if ((x > 0 && board[y][x - 1] == pp) || (x < 7 && board[y][x + 1] == pp))
+            STATE(board)->ep = x + 1;
+        fen += 2;
+    } else if (*fen == '-') {
+        fen++;
+    } else if (*fen && *fen != '\n' && *fen != '\r') {
+        return (0);
+    }
+    while (*fen == ' ')
+        fen++;
+    if (isdigit((unsigned char) *fen)) {
+        long n = strtol(fen, (char **) &fen, 10);
+        STATE(board)->halfmove = (n > 255) ? 255 : n;
+        while (*fen == ' ')
+            fen++;
+        if (moveno && isdigit((unsigned char) *fen))
+            *moveno = atoi(fen);
+    }
+    return (1);
+}
 
-end:
-  ch = fgetc(f);
-  fclose(f);
-  // Update stm based on the character read from FEN
-  if (ch == 'w')
-    stm = 0;
-  else if (ch == 'b')
-    stm = 1;
-  else {
-      warn("Cannot set `stm' variable");
-  }
+void board_fen(BOARD board, s5 side, s5 moveno, char *buf)
+// FEN of a board kept with the side to move at the bottom
+{
+    BOARD aux;
+    char *p = buf;
+    char *castling;
+    s5 x;
+    s5 y;
+    s5 empty;
+    copy_board(board, aux);
+    if (side)
+        transpose(aux);
+    for (y = 7; y >= 0; y--) {
+        empty = 0;
+        for (x = 0; x < 8; x++) {
+            if (!aux[y][x]) {
+                empty++;
+                continue;
+            }
+            if (empty)
+                *p++ = '0' + empty;
+            empty = 0;
+            *p++ = "kqrbnp.PNBRQK"[aux[y][x] + 6];
+        }
+        if (empty)
+            *p++ = '0' + empty;
+        if (y)
+            *p++ = '/';
+    }
+    p += sprintf(p, " %c ", side ? 'b' : 'w');
+    castling = p;
+    if (aux[8][1] && aux[0][4] == _WK && (gchess960 || aux[0][7] == _WR))
+        *p++ = 'K';
+    if (aux[8][0] && aux[0][4] == _WK && (gchess960 || aux[0][0] == _WR))
+        *p++ = 'Q';
+    if (aux[8][3] && aux[7][4] == _BK && (gchess960 || aux[7][7] == _BR))
+        *p++ = 'k';
+    if (aux[8][2] && aux[7][4] == _BK && (gchess960 || aux[7][0] == _BR))
+        *p++ = 'q';
+    if (p == castling)
+        *p++ = '-';
+    if (STATE(aux)->ep)
+        p += sprintf(p, " %c%c", 'a' + STATE(aux)->ep - 1, side ? '3' : '6');
+    else
+        p += sprintf(p, " -");
+    sprintf(p, " %u %d", (unsigned int) STATE(aux)->halfmove, moveno);
 }
 
-void parse_pgn(void)
+int san_move(BOARD board, s5 side, const char *san, MOVE move)
+// The legal move named by a SAN or long algebraic string; returns 0 if no
+// move or more than one matches
 {
-    if (system("/usr/games/pgn-extract -F start.pgn -w200 > pf") != 0) {
-        // Handle error when pgn-extract fails
-        fprintf(stderr, "Error running pgn-extract\n");
-        return;
+    MOVELIST movelist;
+    MOVEINDEX max_index;
+    MOVEINDEX curr_index;
+    char buf[16];
+    s5 len = 0;
+    s5 piece = _WP;
+    s5 prom = 0;
+    s5 fx = -1;
+    s5 fy = -1;
+    s5 tx;
+    s5 ty;
+    s5 found = 0;
+    const char *q;
+    max_index = legal_moves(board, movelist);
+    if (!strncmp(san, "O-O", 3) || !strncmp(san, "0-0", 3)) {
+        tx = (!strncmp(san, "O-O-O", 5) || !strncmp(san, "0-0-0", 5)) ? 2 : 6;
+        for (curr_index = 0; curr_index < max_index; curr_index++)
+        if (board[0][4] == _WK)
+        if (movelist[curr_index][0] == 0 && movelist[curr_index][1] == 4)
+        if (movelist[curr_index][2] == 0 && movelist[curr_index][3] == tx) {
+            copy_move(movelist[curr_index], move);
+            return (1);
+        }
+        return (0);
     }
-    FILE *f = fopen("pf", "r");
-    FILE *g = fopen("start.fen", "w");
-    if (!f || !g) {
-        fprintf(stderr, "Error opening files\n");
-        if (f) fclose(f);
-        if (g) fclose(g);
-        return;
+    for (q = san; *q && len < (s5) sizeof(buf) - 1; q++)
+    if (!strchr("x-:=+#!?", *q))
+        buf[len++] = *q;
+    buf[len] = 0;
+    if (len > 2)
+    if ((q = strchr("NBRQ", buf[len - 1])) && *q) {
+        prom = 2 + (q - "NBRQ");
+        buf[--len] = 0;
     }
-    int ch;
-    BOARD board;
-    copy_board(*get_init(), board);
-    while ((ch = fgetc(f)) != '{') {}
-    while ((ch = fgetc(f)) != '"') {}
-    while ((ch = fgetc(f)) != '"') fputc(ch, g);
-    fclose(f);
-    fclose(g);
-    parse_fen(board);
-    save(board);
+    q = buf;
+    if (*q && strchr("NBRQK", *q)) {
+        piece = 2 + (strchr("NBRQK", *q) - "NBRQK");
+        q++;
+        len--;
+    }
+    if (len < 2 || len > 4)
+        return (0);
+    if (len == 4 || (len == 3 && q[0] >= 'a' && q[0] <= 'h'))
+        fx = *q++ - 'a';
+    if (len == 4 || (len == 3 && q[0] >= '1' && q[0] <= '8'))
+        fy = *q++ - '1';
+    if (q[0] < 'a' || q[0] > 'h' || q[1] < '1' || q[1] > '8')
+        return (0);
+    tx = q[0] - 'a';
+    ty = q[1] - '1';
+    if (side) {
+        ty = 7 - ty;
+        if (fy >= 0)
+            fy = 7 - fy;
+    }
+    for (curr_index = 0; curr_index < max_index; curr_index++) {
+        s3 *m = movelist[curr_index];
+        if (board[m[0]][m[1]] != piece)
+            continue;
+        if (m[2] != ty || m[3] != tx)
+            continue;
+        if ((fx >= 0 && m[1] != fx) || (fy >= 0 && m[0] != fy))
+            continue;
+        if (piece == _WP && m[0] == 6 && m[4] != (prom ? prom : _WQ))
+            continue;
+        copy_move(m, move);
+        found++;
+    }
+    return (found == 1);
+}
+
+void move_san(BOARD board, s5 side, MOVE move, char *buf)
+// SAN of a legal move, with file or rank added only when needed
+{
+    MOVELIST movelist;
+    MOVEINDEX max_index;
+    MOVEINDEX curr_index;
+    BOARD aux;
+    s5 piece = board[(u5) move[0]][(u5) move[1]];
+    s5 samefile = 0;
+    s5 samerank = 0;
+    s5 other = 0;
+    char *p = buf;
+    max_index = legal_moves(board, movelist);
+    if (piece == _WK && move[0] == 0 && move[1] == 4 && move[2] == 0 && (move[3] == 6 || move[3] == 2)) {
+        p += sprintf(p, (move[3] == 6) ? "O-O" : "O-O-O");
+    } else {
+        if (piece != _WP) {
+            *p++ = "..NBRQK"[piece];
+            for (curr_index = 0; curr_index < max_index; curr_index++) {
+                s3 *m = movelist[curr_index];
+                if (board[m[0]][m[1]] != piece || m[2] != move[2] || m[3] != move[3])
+                    continue;
+                if (m[0] == move[0] && m[1] == move[1])
+                    continue;
+                other = 1;
+                samefile |= (m[1] == move[1]);
+                samerank |= (m[0] == move[0]);
+            }
+            if (other && (!samefile || samerank))
+                *p++ = 'a' + move[1];
+            if (other && samefile)
+                *p++ = '1' + (side ? 7 - move[0] : move[0]);
+        }
+        if (board[(u5) move[2]][(u5) move[3]] || (piece == _WP && move[1] != move[3])) {
+            if (piece == _WP)
+                *p++ = 'a' + move[1];
+            *p++ = 'x';
+        }
+        *p++ = 'a' + move[3];
+        *p++ = '1' + (side ? 7 - move[2] : move[2]);
+        if (piece == _WP && move[0] == 6) {
+            *p++ = '=';
+            *p++ = "..NBRQ"[move[4] ? move[4] : _WQ];
+        }
+    }
+    makemove(board, move, aux);
+    if (in_check(aux))
+        *p++ = legal_moves(aux, movelist) ? '+' : '#';
+    *p = 0;
+}
+
+void move_uci(MOVE move, s5 side, char *buf)
+// Coordinate notation, e2e4 or e7e8q
+{
+    char *p = buf;
+    *p++ = 'a' + move[1];
+    *p++ = '1' + (side ? 7 - move[0] : move[0]);
+    *p++ = 'a' + move[3];
+    *p++ = '1' + (side ? 7 - move[2] : move[2]);
+    // Only promotions have move[4] set, and only by addprom()
+    if (move[0] == 6 && move[2] == 7 && move[4] >= _WN && move[4] <= _WQ)
+        *p++ = "..nbrq"[(u5) move[4]];
+    *p = 0;
+}
+
+int uci_move(BOARD board, s5 side, const char *str, MOVE move)
+// The legal move for a coordinate string; returns 0 if there is none
+{
+    MOVELIST movelist;
+    MOVEINDEX max_index;
+    MOVEINDEX curr_index;
+    s5 fx = str[0] - 'a';
+    s5 fy = str[1] - '1';
+    s5 tx = str[2] - 'a';
+    s5 ty = str[3] - '1';
+    s5 prom = 0;
+    const char *q;
+    if (strlen(str) < 4 || fx < 0 || fx > 7 || fy < 0 || fy > 7 || tx < 0 || tx > 7 || ty < 0 || ty > 7)
+        return (0);
+    if (str[4] && (q = strchr("nbrq", str[4])))
+        prom = _WN + (q - "nbrq");
+    if (side) {
+        fy = 7 - fy;
+        ty = 7 - ty;
+    }
+    max_index = legal_moves(board, movelist);
+    for (curr_index = 0; curr_index < max_index; curr_index++) {
+        s3 *m = movelist[curr_index];
+        if (m[0] != fy || m[1] != fx || m[2] != ty || m[3] != tx)
+            continue;
+        if (board[fy][fx] == _WP && fy == 6 && m[4] != (prom ? prom : _WQ))
+            continue;
+        copy_move(m, move);
+        return (1);
+    }
+    return (0);
+}
+
+int pgn_setup(PGNGAME *game)
+// Start position from the FEN tag, or the initial position
+{
+    const char *fen = pgn_tag(game, "FEN");
+    game->start_side = 0;
+    game->start_moveno = 1;
+    if (fen) {
+        if (!fen_board(fen, game->start, &game->start_side, &game->start_moveno))
+            return (0);
+        if (game->start_side)
+            transpose(game->start);
+    } else {
+        copy_board(*get_init(), game->start);
+        score_board(game->start);
+    }
+    copy_board(game->start, game->board);
+    game->side = game->start_side;
+    game->moveno = game->start_moveno;
+    return (1);
+}
+
+const char *pgn_tag(PGNGAME *game, const char *name)
+{
+    s5 i;
+    for (i = 0; i < game->ntags; i++)
+    if (!strcmp(game->tag[i][0], name))
+        return (game->tag[i][1]);
+    return (NULL);
+}
+
+int pgn_next(FILE *f, PGNGAME *game)
+// Reads the next game of a PGN file and replays its moves. Returns 1 for a
+// game, 0 at the end of the file, and -1 for a game with a bad FEN tag or an
+// unknown or illegal move; moves after that one are skipped.
+{
+    char tok[128];
+    BOARD next;
+    s5 len;
+    s5 c;
+    s5 nest = 0; // Depth of variations
+    s5 seen = 0;
+    s5 moves = 0;
+    s5 bad = 0;
+    game->ntags = 0;
+    game->plies = 0;
+    strcpy(game->result, "*");
+    while ((c = getc(f)) != EOF) {
+        if (isspace(c))
+            continue;
+        if (c == '{') {
+            while ((c = getc(f)) != EOF && c != '}');
+            continue;
+        }
+        if (c == ';' || c == '%') {
+            while ((c = getc(f)) != EOF && c != '\n');
+            continue;
+        }
+        if (c == '(' || c == ')') {
+            nest += (c == '(') ? 1 : (nest > 0) ? -1 : 0;
+            continue;
+        }
+        if (c == '[' && !nest) {
+            if (moves) {
+                // Next game, this one had no result
+                ungetc(c, f);
+                break;
+            }
+            seen = 1;
+            if (game->ntags < _PGN_MAXTAGS) {
+                char *name = game->tag[game->ntags][0];
+                char *value = game->tag[game->ntags][1];
+                for (len = 0; (c = getc(f)) != EOF && !isspace(c) && c != ']'; )
+                if (len < 95)
+                    name[len++] = c;
+                name[len] = 0;
+                while (c != EOF && c != '"' && c != ']')
+                    c = getc(f);
+                len = 0;
+                if (c == '"')
+                while ((c = getc(f)) != EOF && c != '"') {
+                    if (c == '\\')
+                        c = getc(f);
+                    if (len < 95)
+                        value[len++] = c;
+                }
+                value[len] = 0;
+                game->ntags++;
+            }
+            while (c != EOF && c != ']')
+                c = getc(f);
+            continue;
+        }
+        for (len = 0; c != EOF && !isspace(c) && !strchr("{}()[];", c); c = getc(f))
+        if (len < (s5) sizeof(tok) - 1)
+            tok[len++] = c;
+        tok[len] = 0;
+        if (c != EOF && !isspace(c))
+            ungetc(c, f);
+        if (nest || tok[0] == '$' || !strcmp(tok, "e.p."))
+            continue;
+        seen = 1;
+        if (!moves) {
+            moves = 1;
+            if (!pgn_setup(game))
+                bad = 1;
+        }
+        if (!strcmp(tok, "1-0") || !strcmp(tok, "0-1") || !strcmp(tok, "1/2-1/2") || !strcmp(tok, "*")) {
+            strcpy(game->result, tok);
+            break;
+        }
+        // Move numbers, "12." or "12...", may be joined to the move
+        char *san = tok;
+        while (isdigit((unsigned char) *san))
+            san++;
+        if (*san == '.')
+            while (*san == '.')
+                san++;
+        else
+            san = tok;
+        if (!*san || bad || game->skipmoves)
+            continue;
+        if (game->plies >= _PGN_MAXPLIES || !san_move(game->board, game->side, san, game->moves[game->plies])) {
+            bad = 1;
+            continue;
+        }
+        makemove(game->board, game->moves[game->plies], next);
+        copy_board(next, game->board);
+        game->plies++;
+        game->moveno += game->side;
+        game->side = 1 - game->side;
+    }
+    if (!seen)
+        return (0);
+    if (!moves && !pgn_setup(game))
+        bad = 1;
+    return (bad ? -1 : 1);
+}
+
+typedef struct {
+    const char *name;
+    long from;
+    long to;
+} DBRANGE;
+
+typedef struct {
+    s5 id;
+    DBENTRY *buf;
+    u6 len;
+    u6 cap;
+    s5 runs; // Sorted files written so far, name.run.<id>.<k>
+    u6 games;
+    u6 skipped;
+    s5 failed;
+    PGNGAME game;
+} DBJOB;
+
+DBRANGE *dbranges;
+s5 dbnranges;
+s5 dbnext;
+pthread_mutex_t dblock = PTHREAD_MUTEX_INITIALIZER;
+const char *dbname;
+
+int db_cmp(const void *a, const void *b)
+{
+    const DBENTRY *x = (const DBENTRY *) a;
+    const DBENTRY *y = (const DBENTRY *) b;
+    if (x->key != y->key)
+        return (x->key < y->key ? -1 : 1);
+    return (x->move < y->move ? -1 : x->move > y->move);
+}
+
+void db_spill(DBJOB *job)
+// Sorts the buffer, folds equal (key, move) records and writes it as a run
+{
+    char name[4096];
+    FILE *f;
+    u6 i;
+    u6 n = 0;
+    if (!job->len)
+        return;
+    qsort(job->buf, job->len, sizeof(DBENTRY), db_cmp);
+    for (i = 1; i < job->len; i++) {
+        if (!db_cmp(&job->buf[n], &job->buf[i])) {
+            job->buf[n].count[0] += job->buf[i].count[0];
+            job->buf[n].count[1] += job->buf[i].count[1];
+            job->buf[n].count[2] += job->buf[i].count[2];
+        } else {
+            job->buf[++n] = job->buf[i];
+        }
+    }
+    n++;
+    snprintf(name, sizeof(name), "%s.run.%d.%d", dbname, job->id, job->runs);
+    f = fopen(name, "wb");
+    if (!f || fwrite(job->buf, sizeof(DBENTRY), n, f) != n) {
+        warn("Cannot write dbbuild run");
+        job->failed = 1;
+        if (f)
+            remove(name);
+    } else {
+        job->runs++;
+    }
+    if (f)
+        fclose(f);
+    job->len = 0;
+}
+
+void *db_range(void *arg)
+// Replays the games of each range it takes and records every move played
+{
+    DBJOB *job = (DBJOB *) arg;
+    PGNGAME *game = &job->game;
+    BOARD board;
+    BOARD next;
+    s5 r;
+    s5 ply;
+    while (1) {
+        pthread_mutex_lock(&dblock);
+        s5 t = dbnext++;
+        pthread_mutex_unlock(&dblock);
+        if (t >= dbnranges)
+            break;
+        DBRANGE *range = &dbranges[t];
+        FILE *f = fopen(range->name, "r");
+        if (!f) {
+            warn("Cannot open .pgn file");
+            job->failed = 1;
+            continue;
+        }
+        long pos = pgn_sync(f, range->from);
+        if (pos >= 0)
+            fseek(f, pos, SEEK_SET);
+        if (pos >= 0)
+        while ((r = pgn_range_next(f, range->to, game, &pos))) {
+            // Unfinished games and games with a bad move say nothing
+            s5 white = !strcmp(game->result, "1-0") ? 0 : !strcmp(game->result, "1/2-1/2") ? 1 : \
+                !strcmp(game->result, "0-1") ? 2 : -1;
+            if (r < 0 || white < 0) {
+                job->skipped++;
+                continue;
+            }
+            job->games++;
+            copy_board(game->start, board);
+            for (ply = 0; ply < game->plies; ply++) {
+                if (job->len == job->cap)
+                    db_spill(job);
+                DBENTRY *e = &job->buf[job->len++];
+                e->key = board_key(board);
+                e->move = move_pack(game->moves[ply]);
+                e->count[0] = e->count[1] = e->count[2] = 0;
+                e->count[((game->start_side + ply) % 2) ? 2 - white : white] = 1;
+                makemove(board, game->moves[ply], next);
+                copy_board(next, board);
+            }
+        }
+        fclose(f);
+    }
+    db_spill(job);
+    return (NULL);
+}
+
+int dbbuild(const char *name, char **pgns, s5 npgns)
+// Position statistics of PGN files: ranges of the files are replayed in
+// parallel into sorted runs of at most gdbmem MB, and the runs are merged
+// into one table sorted by key, which db_open() maps
+{
+    char run[4096];
+    char tmpname[4096];
+    DBHEADER header;
+    DBENTRY e;
+    FILE *f = NULL;
+    FILE **runs = NULL;
+    DBENTRY *head = NULL;
+    DBJOB *jobs = NULL;
+    u6 games = 0;
+    u6 skipped = 0;
+    s5 n = gthreads;
+    s5 nruns = 0;
+    s5 started = 0;
+    s5 failed = 0;
+    s5 t;
+    s5 k;
+    int ret = 1;
+    ELAPSED clock;
+    if (!npgns) {
+        warn("No .pgn files");
+        return (1);
+    }
+    if (n < 1)
+        n = (s5) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    pthread_t threads[n];
+    init(&clock);
+    dbname = name;
+    dbnranges = 0;
+    dbnext = 0;
+    dbranges = (DBRANGE *) malloc(npgns * n * sizeof(DBRANGE));
+    jobs = (DBJOB *) calloc(n, sizeof(DBJOB));
+    if (!dbranges || !jobs) {
+        warn("Out of memory");
+        goto done;
+    }
+    for (k = 0; k < npgns; k++) {
+        struct stat st;
+        if (stat(pgns[k], &st)) {
+            warn("Cannot open .pgn file");
+            goto done;
+        }
+        for (t = 0; t < n; t++) {
+            dbranges[dbnranges].name = pgns[k];
+            dbranges[dbnranges].from = st.st_size * t / n;
+            dbranges[dbnranges].to = st.st_size * (t + 1) / n;
+            dbnranges++;
+        }
+    }
+    for (t = 0; t < n; t++) {
+        jobs[t].id = t;
+        jobs[t].cap = ((u6) gdbmem << 20) / n / sizeof(DBENTRY);
+        if (jobs[t].cap < 1024)
+            jobs[t].cap = 1024;
+        jobs[t].buf = (DBENTRY *) malloc(jobs[t].cap * sizeof(DBENTRY));
+        if (!jobs[t].buf) {
+            warn("Out of memory");
+            break;
+        }
+        if (pthread_create(&threads[t], NULL, db_range, &jobs[t])) {
+            warn("Cannot start dbbuild thread");
+            break;
+        }
+        started++;
+    }
+    // The threads that did start take all the ranges; wait for them even
+    // when the build has failed, so their runs can be removed
+    for (t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        games += jobs[t].games;
+        skipped += jobs[t].skipped;
+        nruns += jobs[t].runs;
+        if (jobs[t].failed)
+            failed = 1;
+    }
+    if (failed || started < n)
+        goto done;
+    // k-way merge of the runs, folding equal records across them
+    runs = (FILE **) malloc((nruns + 1) * sizeof(FILE *));
+    head = (DBENTRY *) malloc((nruns + 1) * sizeof(DBENTRY));
+    nruns = 0;
+    if (!runs || !head) {
+        warn("Out of memory");
+        goto done;
+    }
+    for (t = 0; t < n; t++)
+    for (k = 0; k < jobs[t].runs; k++) {
+        snprintf(run, sizeof(run), "%s.run.%d.%d", name, t, k);
+        runs[nruns] = fopen(run, "rb");
+        if (!runs[nruns]) {
+            warn("Cannot open dbbuild run");
+            goto done;
+        }
+        // Unlinked now, gone when closed
+        remove(run);
+        if (fread(&head[nruns], sizeof(DBENTRY), 1, runs[nruns]) == 1)
+            nruns++;
+        else
+            fclose(runs[nruns]);
+    }
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+    f = fopen(tmpname, "wb");
+    if (!f) {
+        warn("Cannot open db file for write");
+        goto done;
+    }
+    header.magic = _DBMAGIC;
+    header.version = _DBVERSION;
+    header.keysig = hash_board(*get_init());
+    header.count = 0;
+    fwrite(&header, sizeof(header), 1, f);
+    while (nruns) {
+        s5 m = 0;
+        for (k = 1; k < nruns; k++)
+        if (db_cmp(&head[k], &head[m]) < 0)
+            m = k;
+        if (header.count && !db_cmp(&e, &head[m])) {
+            e.count[0] += head[m].count[0];
+            e.count[1] += head[m].count[1];
+            e.count[2] += head[m].count[2];
+        } else {
+            if (header.count)
+                fwrite(&e, sizeof(e), 1, f);
+            e = head[m];
+            header.count++;
+        }
+        if (fread(&head[m], sizeof(DBENTRY), 1, runs[m]) != 1) {
+            fclose(runs[m]);
+            runs[m] = runs[--nruns];
+            head[m] = head[nruns];
+        }
+    }
+    if (header.count)
+        fwrite(&e, sizeof(e), 1, f);
+    rewind(f);
+    fwrite(&header, sizeof(header), 1, f);
+    failed = ferror(f);
+    if (fclose(f))
+        failed = 1;
+    f = NULL;
+    if (failed) {
+        warn("Cannot write db file");
+        remove(tmpname);
+        goto done;
+    }
+    if (rename(tmpname, name)) {
+        warn("Cannot rename db file");
+        remove(tmpname);
+        goto done;
+    }
+    update(&clock);
+    fprintf(stdout, "Games: %llu, skipped %llu, %llu entries, %d threads, %.2lf s\n", \
+        games, skipped, header.count, n, dclock(&clock));
+    ret = 0;
+done:
+    // One way out: the open runs are closed, the runs not yet merged and a
+    // partial table removed, and everything allocated freed
+    if (f) {
+        fclose(f);
+        remove(tmpname);
+    }
+    for (k = 0; k < nruns; k++)
+        fclose(runs[k]);
+    if (jobs)
+    for (t = 0; t < n; t++) {
+        for (k = 0; k < jobs[t].runs; k++) {
+            snprintf(run, sizeof(run), "%s.run.%d.%d", name, t, k);
+            remove(run);
+        }
+        free(jobs[t].buf);
+    }
+    free(head);
+    free(runs);
+    free(jobs);
+    free(dbranges);
+    dbranges = NULL;
+    return (ret);
+}
+
+int db_open(const char *name)
+// Maps a dbbuild table read-only; the pages are shared with other processes
+{
+    DBHEADER *header;
+    struct stat st;
+    void *p;
+    s5 fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        warn("Cannot open db file");
+        return (0);
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(DBHEADER)) {
+        warn("Bad db file");
+        close(fd);
+        return (0);
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        warn("Cannot map db file");
+        return (0);
+    }
+    header = (DBHEADER *) p;
+    if (header->magic != _DBMAGIC || \
+        header->version != _DBVERSION || \
+        header->keysig != hash_board(*get_init()) || \
+        sizeof(DBHEADER) + header->count * sizeof(DBENTRY) > (u6) st.st_size) {
+        warn("Ignoring stale db file");
+        munmap(p, st.st_size);
+        return (0);
+    }
+    gdb = (DBENTRY *) (header + 1);
+    gdbcount = header->count;
+    return (1);
+}
+
+u6 db_find(u6 key, u6 *count)
+// First entry of `key' by binary search, and in *count how many follow
+{
+    u6 lo = 0;
+    u6 hi = gdbcount;
+    u6 i;
+    while (lo < hi) {
+        u6 mid = lo + (hi - lo) / 2;
+        if (gdb[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (i = lo; i < gdbcount && gdb[i].key == key; i++);
+    *count = i - lo;
+    return (lo);
+}
+
+void db_order(BOARD board, MOVELIST movelist, MOVEINDEX max_index)
+// Root moves played in the database first, the most played leading; the
+// rest keep the order they had
+{
+    u6 games[_MAXINDEX];
+    u6 count;
+    u6 first = db_find(board_key(board), &count);
+    MOVEINDEX i;
+    MOVEINDEX j;
+    u6 k;
+    if (!count)
+        return;
+    for (i = 0; i < max_index; i++) {
+        u5 packed = move_pack(movelist[i]);
+        games[i] = 0;
+        for (k = first; k < first + count; k++)
+        if (gdb[k].move == packed)
+            games[i] = gdb[k].count[0] + gdb[k].count[1] + gdb[k].count[2];
+    }
+    for (i = 1; i < max_index; i++) {
+        MOVE move;
+        u6 g = games[i];
+        copy_move(movelist[i], move);
+        for (j = i; j > 0 && games[j - 1] < g; j--) {
+            games[j] = games[j - 1];
+            copy_move(movelist[j - 1], movelist[j]);
+        }
+        games[j] = g;
+        copy_move(move, movelist[j]);
+    }
+}
+
+int dbquery(const char *fen)
+// Moves played from a position, most played first, with the score of the
+// side to move
+{
+    BOARD board;
+    MOVE move;
+    char buf[16];
+    s5 side;
+    u6 count;
+    u6 first;
+    u6 i;
+    u6 j;
+    ELAPSED clock;
+    if (!fen_board(fen, board, &side, NULL)) {
+        warn("Bad FEN");
+        return (1);
+    }
+    if (side)
+        transpose(board);
+    init(&clock);
+    first = db_find(board_key(board), &count);
+    update(&clock);
+    DBENTRY entries[count + 1];
+    for (i = 0; i < count; i++) {
+        entries[i] = gdb[first + i];
+        for (j = i; j > 0 && entries[j - 1].count[0] + entries[j - 1].count[1] + entries[j - 1].count[2] < \
+            entries[j].count[0] + entries[j].count[1] + entries[j].count[2]; j--) {
+            DBENTRY e = entries[j];
+            entries[j] = entries[j - 1];
+            entries[j - 1] = e;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        u5 *c = entries[i].count;
+        u5 total = c[0] + c[1] + c[2];
+        move_unpack(entries[i].move, move);
+        move_san(board, side, move, buf);
+        fprintf(stdout, "%s %u +%u =%u -%u %.1lf%%\n", buf, total, c[0], c[1], c[2], \
+            100.0 * (c[0] + 0.5 * c[1]) / total);
+    }
+    fprintf(stdout, "Entries: %llu of %llu, %.0lf us\n", count, gdbcount, 1e6 * dclock(&clock));
+    return (0);
+}
+
+long pgn_sync(FILE *f, long from)
+// Offset of the first game at or after `from': a tag line after a blank
+// line, as games are separated in export format. Every range boundary is
+// cut the same way, so each game is read by exactly one range.
+{
+    char line[1024];
+    long pos;
+    s5 c = '\n';
+    s5 blank;
+    if (!from)
+        return (0);
+    fseek(f, (from >= 2) ? from - 2 : 0, SEEK_SET);
+    if (from >= 2)
+        c = getc(f);
+    // The line that ends at or after from - 1 only tells if it is blank
+    if (!fgets(line, sizeof(line), f))
+        return (-1);
+    blank = (c == '\n') && strchr(line, '\n') && !line[strspn(line, " \t\r\n")];
+    while (!strchr(line, '\n') && fgets(line, sizeof(line), f));
+    while ((pos = ftell(f)), fgets(line, sizeof(line), f)) {
+        if (line[0] == '[' && blank)
+            return (pos);
+        blank = strchr(line, '\n') && !line[strspn(line, " \t\r\n")];
+        while (!strchr(line, '\n') && fgets(line, sizeof(line), f));
+    }
+    return (-1);
+}
+
+s5 pgn_range_next(FILE *f, long to, PGNGAME *game, long *start)
+// The next game of a range cut by pgn_sync(), if it starts before `to';
+// *start is its offset
+{
+    s5 c;
+    while ((c = getc(f)) != EOF && isspace(c));
+    if (c == EOF)
+        return (0);
+    ungetc(c, f);
+    *start = ftell(f);
+    if (*start >= to)
+        return (0);
+    return (pgn_next(f, game));
+}
+
+typedef struct {
+    const char *map;
+    long size;
+    long from;
+    long to;
+    char *out; // Matching games of the chunk, written in chunk order
+    size_t len;
+    s5 done;
+} PGNCHUNK;
+
+PGNCHUNK *pfchunks;
+s5 pfnchunks;
+s5 pfnext;
+s5 pfwritten;
+u6 pfgames;
+u6 pfkept;
+pthread_mutex_t pflock = PTHREAD_MUTEX_INITIALIZER;
+
+int str_has(const char *hay, const char *needle)
+// Case-insensitive strstr()
+{
+    size_t n = strlen(needle);
+    for (; *hay; hay++)
+    if (!strncasecmp(hay, needle, n))
+        return (1);
+    return (!n);
+}
+
+int pgn_match(PGNGAME *game)
+// The header and result filters of pgnf
+{
+    const char *white = pgn_tag(game, "White");
+    const char *black = pgn_tag(game, "Black");
+    s5 i;
+    if (!white)
+        white = "";
+    if (!black)
+        black = "";
+    if (pgnf.player)
+    if (!str_has(white, pgnf.player) && !str_has(black, pgnf.player))
+        return (0);
+    if (pgnf.white && !str_has(white, pgnf.white))
+        return (0);
+    if (pgnf.black && !str_has(black, pgnf.black))
+        return (0);
+    if (pgnf.event) {
+        const char *event = pgn_tag(game, "Event");
+        if (!event || !str_has(event, pgnf.event))
+            return (0);
+    }
+    if (pgnf.elomin || pgnf.elomax) {
+        const char *elo[2] = { pgn_tag(game, "WhiteElo"), pgn_tag(game, "BlackElo") };
+        for (i = 0; i < 2; i++)
+        if (!elo[i] || atoi(elo[i]) < pgnf.elomin || atoi(elo[i]) > pgnf.elomax)
+            return (0);
+    }
+    if (pgnf.result && strcmp(game->result, pgnf.result))
+        return (0);
+    return (1);
+}
+
+int pgn_reaches(PGNGAME *game)
+// Any position of pgnf, with the same side to move, as far as the moves
+// were legal
+{
+    BOARD board;
+    BOARD next;
+    s5 ply;
+    s5 i;
+    copy_board(game->start, board);
+    for (ply = 0; ; ply++) {
+        u6 key = board_key(board);
+        for (i = 0; i < pgnf.npos; i++)
+        if (key == pgnf.key[i] && (game->start_side + ply) % 2 == pgnf.side[i])
+            return (1);
+        if (ply == game->plies)
+            break;
+        makemove(board, game->moves[ply], next);
+        copy_board(next, board);
+    }
+    return (0);
+}
+
+void *pgnfilter_range(void *arg)
+// Filters the chunks it takes; whoever finishes the next chunk due writes it
+{
+    PGNGAME *game = (PGNGAME *) malloc(sizeof(PGNGAME));
+    u6 games = 0;
+    u6 kept = 0;
+    s5 r;
+    (void) arg;
+    if (!game) {
+        warn("Out of memory");
+        return (NULL);
+    }
+    // Games are only replayed once their headers pass
+    game->skipmoves = 1;
+    while (1) {
+        pthread_mutex_lock(&pflock);
+        s5 t = pfnext++;
+        pthread_mutex_unlock(&pflock);
+        if (t >= pfnchunks)
+            break;
+        PGNCHUNK *chunk = &pfchunks[t];
+        size_t cap = 0;
+        FILE *f = fmemopen((void *) chunk->map, chunk->size, "r");
+        long start;
+        long pos = f ? pgn_sync(f, chunk->from) : -1;
+        if (pos >= 0)
+            fseek(f, pos, SEEK_SET);
+        if (pos >= 0)
+        while ((r = pgn_range_next(f, chunk->to, game, &start))) {
+            games++;
+            if (!pgn_match(game))
+                continue;
+            long end = ftell(f);
+            if (pgnf.npos) {
+                fseek(f, start, SEEK_SET);
+                game->skipmoves = 0;
+                pgn_next(f, game);
+                game->skipmoves = 1;
+                if (!pgn_reaches(game))
+                    continue;
+            }
+            kept++;
+            while (end > start && isspace((unsigned char) chunk->map[end - 1]))
+                end--;
+            if (chunk->len + (end - start) + 2 > cap) {
+                cap = 2 * (chunk->len + (end - start) + 2);
+                chunk->out = (char *) realloc(chunk->out, cap);
+            }
+            memcpy(chunk->out + chunk->len, chunk->map + start, end - start);
+            chunk->len += end - start;
+            chunk->out[chunk->len++] = '\n';
+            chunk->out[chunk->len++] = '\n';
+        }
+        if (f)
+            fclose(f);
+        pthread_mutex_lock(&pflock);
+        chunk->done = 1;
+        while (pfwritten < pfnchunks && pfchunks[pfwritten].done) {
+            PGNCHUNK *c = &pfchunks[pfwritten++];
+            if (c->len)
+                fwrite(c->out, 1, c->len, stdout);
+            free(c->out);
+            c->out = NULL;
+        }
+        pthread_mutex_unlock(&pflock);
+    }
+    pthread_mutex_lock(&pflock);
+    pfgames += games;
+    pfkept += kept;
+    pthread_mutex_unlock(&pflock);
+    free(game);
+    return (NULL);
+}
+
+int pgnfilter(char **pgns, s5 npgns)
+// Games of the PGN files that pass every filter of pgnf, to stdout in
+// their original order and text. The files are mapped and cut into chunks
+// of _PGNCHUNK bytes that the threads filter independently.
+{
+    void *maps[npgns + 1];
+    long sizes[npgns + 1];
+    s5 n = gthreads;
+    s5 t;
+    s5 k;
+    ELAPSED clock;
+    if (!npgns) {
+        warn("No .pgn files");
+        return (1);
+    }
+    for (k = 0; k < pgnf.npos; k++) {
+        BOARD board;
+        if (!fen_board(pgnf.fen[k], board, &pgnf.side[k], NULL)) {
+            warn("Bad FEN");
+            return (1);
+        }
+        if (pgnf.side[k])
+            transpose(board);
+        pgnf.key[k] = board_key(board);
+    }
+    if (n < 1)
+        n = (s5) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    init(&clock);
+    for (k = 0; k < npgns; k++) {
+        struct stat st;
+        s5 fd = open(pgns[k], O_RDONLY);
+        if (fd < 0 || fstat(fd, &st)) {
+            warn("Cannot open .pgn file");
+            return (1);
+        }
+        sizes[k] = st.st_size;
+        maps[k] = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        close(fd);
+        if (maps[k] == MAP_FAILED) {
+            warn("Cannot map .pgn file");
+            return (1);
+        }
+        if (maps[k])
+            madvise(maps[k], st.st_size, MADV_SEQUENTIAL);
+        pfnchunks += (st.st_size + _PGNCHUNK - 1) / _PGNCHUNK;
+    }
+    pfchunks = (PGNCHUNK *) calloc(pfnchunks + 1, sizeof(PGNCHUNK));
+    if (!pfchunks) {
+        warn("Out of memory");
+        return (1);
+    }
+    pfnchunks = 0;
+    for (k = 0; k < npgns; k++) {
+        long from;
+        for (from = 0; from < sizes[k]; from += _PGNCHUNK) {
+            PGNCHUNK *chunk = &pfchunks[pfnchunks++];
+            chunk->map = (const char *) maps[k];
+            chunk->size = sizes[k];
+            chunk->from = from;
+            chunk->to = (from + _PGNCHUNK < sizes[k]) ? from + _PGNCHUNK : sizes[k];
+        }
+    }
+    pthread_t threads[n];
+    for (t = 0; t < n; t++)
+        pthread_create(&threads[t], NULL, pgnfilter_range, NULL);
+    for (t = 0; t < n; t++)
+        pthread_join(threads[t], NULL);
+    fflush(stdout);
+    for (k = 0; k < npgns; k++)
+    if (maps[k])
+        munmap(maps[k], sizes[k]);
+    free(pfchunks);
+    update(&clock);
+    fprintf(stderr, "Games: %llu, matched %llu, %d threads, %.2lf s\n", pfgames, pfkept, n, dclock(&clock));
+    return (0);
+}
+
+void parse_fen(BOARD board) {
+  FILE *f;
+  char line[256];
+  s5 side;
+  f = fopen("start.fen", "r");
+  if (!f) {
+    warn("warn in parse_fen");
+    return;
+  }
+  if (!fgets(line, sizeof(line), f))
+    line[0] = 0;
+  fclose(f);
+  if (fen_board(line, board, &side, NULL))
+    stm = side;
+  else
+    warn("Cannot set `stm' variable");
+}
+
+int read_position(BOARD start)
+// The root position, by ginput; only start.brd goes through a file format
+// of its own, every other source is parsed in memory
+{
+    char fen[256];
+    BOARD aux;
+    s5 side;
+    s5 moveno = 1;
+    if (ginput == INPUT_BRD) {
+        load(start);
+        return (1);
+    }
+    if (ginput == INPUT_PGN || ginput == INPUT_PGNFEN) {
+        static PGNGAME game;
+        FILE *f = fopen(gpgn, "r");
+        s5 r = f ? pgn_next(f, &game) : 0;
+        if (f)
+            fclose(f);
+        if (r <= 0) {
+            warn(r ? "Bad move or FEN in .pgn file" : "Cannot read .pgn file");
+            return (0);
+        }
+        copy_board(game.board, start);
+        side = game.side;
+        moveno = game.moveno;
+    } else {
+        if (gfen) {
+            snprintf(fen, sizeof(fen), "%s", gfen);
+        } else {
+            FILE *f = fopen(_FENFILE, "r");
+            if (!f || !fgets(fen, sizeof(fen), f)) {
+                warn("Cannot read .fen file");
+                if (f)
+                    fclose(f);
+                return (0);
+            }
+            fclose(f);
+        }
+        if (!fen_board(fen, start, &side, &moveno)) {
+            warn("Bad FEN");
+            return (0);
+        }
+        if (side)
+            transpose(start);
+    }
+    stm = side;
+    if (gprintfen || ginput == INPUT_PGNFEN) {
+        board_fen(start, side, moveno, fen);
+        fprintf(stdout, "%s\n", fen);
+        exit(0);
+    }
+    copy_board(start, aux);
+    if (side)
+        transpose(aux);
+    if (!gjson)
+        show_board(aux, stdout);
+    return (1);
+}
+
+u6 hash_rand(u6 *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+void hash_init(void)
+// Keys come from a fixed seed so that saved tables stay valid across runs
+{
+    u6 state = 0x9e3779b97f4a7c15ULL;
+    u5 p;
+    u5 sq;
+    for (p = 0; p < 13; p++)
+    for (sq = 0; sq < 64; sq++)
+        zobrist[p][sq] = (p == 6) ? 0 : hash_rand(&state);
+    for (p = 0; p < 4; p++)
+        zobrist_castle[p] = hash_rand(&state);
+    for (p = 0; p < 2; p++)
+    for (sq = 0; sq < 64; sq++)
+        zobrist_pawn[p][sq] = (u5) hash_rand(&state);
+    for (p = 1; p < 9; p++)
+        zobrist_ep[p] = hash_rand(&state);
+    if (!hashtable)
+        hashtable = (HASHENTRY *) calloc(1 << ghashbits, sizeof(HASHENTRY));
+    if (!hashtable) {
+        warn("Out of memory");
+        exit(1);
+    }
+}
+
+void hash_resize(u5 bits)
+// New, empty table of 2^bits entries
+{
+    free(hashtable);
+    ghashbits = bits;
+    hashtable = (HASHENTRY *) calloc(1 << ghashbits, sizeof(HASHENTRY));
+    if (!hashtable) {
+        warn("Out of memory");
+        exit(1);
+    }
+}
+
+u6 hash_board(BOARD board)
+{
+    u6 key = 0;
+    u5 x;
+    u5 y;
+    for (y = 0; y < 8; y++)
+    for (x = 0; x < 8; x++)
+    if (board[y][x])
+        key ^= zobrist[board[y][x] + 6][(y << 3) | x];
+    for (x = 0; x < 4; x++)
+    if (board[8][x])
+        key ^= zobrist_castle[x];
+    key ^= zobrist_ep[STATE(board)->ep];
+    return key;
+}
+
+u6 board_key(BOARD board)
+// Same value as hash_board(), from the keys kept in row 9
+{
+    u6 key;
+    u5 x;
+    memcpy(&key, STATE(board)->key, sizeof(key));
+    for (x = 0; x < 4; x++)
+    if (board[8][x])
+        key ^= zobrist_castle[x];
+    key ^= zobrist_ep[STATE(board)->ep];
+    return (key);
+}
+
+s5 eval_cache(BOARD board, u5 field)
+// Position-only parts of eval(), filled in lazily per field.
+// Lockless: an entry is valid only if check ^ data gives back the key.
+{
+    BOARD aux;
+    u6 key = board_key(board);
+    EVALENTRY *entry = &evaltable[key & ((1 << _EVALBITS) - 1)];
+    u6 data = entry->data;
+    s5 result;
+    PROF(PHASES phase = prof_enter((field == _EC_MAXCAP) ? PH_GENFAST : PH_CHECK));
+    evalprobes++;
+    STAT(gstats.cacheprobes++);
+    if ((entry->check ^ data) != key)
+        data = 0;
+    else if (data & (8ULL << (4 * field))) {
+        evalhits++;
+        STAT(gstats.cachehits++);
+        PROF(prof_leave(phase));
+        return ((data >> (4 * field)) & 7);
+    }
+    switch (field) {
+    case _EC_CHECK:
+        result = in_check(board);
+        break;
+    case _EC_ECHECK:
+        copy_board(board, aux);
+        transpose(aux);
+        result = in_check(aux);
+        break;
+    default:
+        result = genFast(board);
+    }
+    data |= (u6) (8 | result) << (4 * field);
+    entry->data = data;
+    entry->check = key ^ data;
+    PROF(prof_leave(phase));
+    return (result);
+}
+
+HASHENTRY *hash_probe(u6 key)
+// Buckets hold a depth-preferred slot followed by an always-replace slot
+{
+    HASHENTRY *entry = &hashtable[key & ((1 << ghashbits) - 2)];
+    if (entry[0].key == key)
+        return (&entry[0]);
+    if (entry[1].key == key)
+        return (&entry[1]);
+    return (NULL);
+}
+
+u5 hash_full(void)
+// Permille of the first thousand entries in use, as UCI reports it
+{
+    u5 n;
+    u5 used = 0;
+    for (n = 0; n < 1000; n++)
+    if (hashtable[n].key)
+        used++;
+    return (used);
+}
+
+void hash_put(u6 key, s4 value, u5 data)
+{
+    HASHENTRY *entry = &hashtable[key & ((1 << ghashbits) - 2)];
+    // A shallow transposition must not evict the deep result of the same key
+    if ((entry->data & 0xff) > (data & 0xff))
+        entry++;
+    entry->key = key;
+    entry->value = value;
+    entry->data = data;
+}
+
+void hash_store(u6 key, VALUE value, LEVEL depth, s5 bound, MOVE move, LEVEL level)
+{
+    u5 packed;
+    // Mate scores are stored relative to the node, not to the root
+    if (value > _THRESHOLD)
+        value += level;
+    else if (value < -_THRESHOLD)
+        value -= level;
+    packed = move_pack(move);
+    hash_put(key, value, (depth & 0xff) | (bound << 8) | (packed << 10));
+}
+
+VALUE hash_value(HASHENTRY *entry, LEVEL level)
+{
+    VALUE value = entry->value;
+    if (value > _THRESHOLD)
+        value -= level;
+    else if (value < -_THRESHOLD)
+        value += level;
+    return (value);
+}
+
+LEVEL hash_depth(HASHENTRY *entry)
+{
+    return (entry->data & 0xff);
+}
+
+s5 hash_bound(HASHENTRY *entry)
+{
+    return ((entry->data >> 8) & 3);
+}
+
+void hash_move(HASHENTRY *entry, MOVE move)
+{
+    move_unpack(entry->data >> 10, move);
+}
+
+u5 move_pack(MOVE move)
+// Squares and promotion in 15 bits
+{
+    return (move[0] | (move[1] << 3) | (move[2] << 6) | (move[3] << 9) | (move[4] << 12));
+}
+
+void move_unpack(u5 packed, MOVE move)
+{
+    move[0] = packed & 7;
+    move[1] = (packed >> 3) & 7;
+    move[2] = (packed >> 6) & 7;
+    move[3] = (packed >> 9) & 7;
+    move[4] = (packed >> 12) & 7;
+    move[5] = 0;
+}
+
+u6 hash_checksum(HASHENTRY *entries, u6 count)
+{
+    u6 sum = 0xcbf29ce484222325ULL;
+    unsigned char *p = (unsigned char *) entries;
+    u6 n;
+    for (n = 0; n < count * sizeof(HASHENTRY); n++) {
+        sum ^= p[n];
+        sum *= 0x100000001b3ULL;
+    }
+    return (sum);
+}
+
+void hash_save(const char *name)
+// Written to a temporary file first, so a killed run never leaves half a table
+{
+    FILE *f;
+    HASHHEADER header;
+    HASHENTRY *entries;
+    char tmpname[4096];
+    u6 n;
+    entries = (HASHENTRY *) malloc((1 << ghashbits) * sizeof(HASHENTRY));
+    if (!entries) {
+        warn("Out of memory");
+        return;
+    }
+    header.count = 0;
+    for (n = 0; n < (1 << ghashbits); n++)
+    if (hashtable[n].key)
+    if (hash_depth(&hashtable[n]) >= _HASHSAVEDEPTH)
+        entries[header.count++] = hashtable[n];
+    header.magic = _HASHMAGIC;
+    header.version = _HASHVERSION;
+    header.keysig = hash_board(*get_init());
+    header.checksum = hash_checksum(entries, header.count);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+    f = fopen(tmpname, "wb");
+    if (!f) {
+        warn("Cannot open hash file for write");
+        free(entries);
+        return;
+    }
+    if (fwrite(&header, sizeof(header), 1, f) != 1 || \
+        fwrite(entries, sizeof(HASHENTRY), header.count, f) != header.count) {
+        warn("Cannot write hash file");
+        fclose(f);
+        free(entries);
+        remove(tmpname);
+        return;
+    }
+    fclose(f);
+    free(entries);
+    rename(tmpname, name);
+}
+
+void hash_load(const char *name)
+{
+    FILE *f;
+    HASHHEADER header;
+    HASHENTRY *entries;
+    u6 n;
+    f = fopen(name, "rb");
+    if (!f)
+        return;
+    if (fread(&header, sizeof(header), 1, f) != 1 || \
+        header.magic != _HASHMAGIC || \
+        header.version != _HASHVERSION || \
+        header.keysig != hash_board(*get_init()) || \
+        header.count > (1 << ghashbits)) {
+        warn("Ignoring stale hash file");
+        fclose(f);
+        return;
+    }
+    entries = (HASHENTRY *) malloc(header.count * sizeof(HASHENTRY) + 1);
+    if (!entries) {
+        warn("Out of memory");
+        fclose(f);
+        return;
+    }
+    if (fread(entries, sizeof(HASHENTRY), header.count, f) != header.count || \
+        hash_checksum(entries, header.count) != header.checksum) {
+        warn("Ignoring corrupt hash file");
+    } else {
+        for (n = 0; n < header.count; n++)
+            hash_put(entries[n].key, entries[n].value, entries[n].data);
+    }
+    fclose(f);
+    free(entries);
+}
+
+void checkpoint_save(const char *name, BOARD start, LEVEL depth)
+// Everything needed to continue the depth loop after `depth', written atomically
+{
+    FILE *f;
+    TREE *tree = &treea[0];
+    char tmpname[4096];
+    MOVELIST moves;
+    VALUE values[_MAXINDEX];
+    MOVEINDEX n = 0;
+    MOVEINDEX i;
+    MOVEINDEX j;
+    LEVEL k;
+    u5 x;
+    u5 y;
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+    f = fopen(tmpname, "w");
+    if (!f) {
+        warn("Cannot open checkpoint file for write");
+        return;
+    }
+    fprintf(f, "checkpoint %d\n", _CKPTVERSION);
+    fprintf(f, "mode %d\n", (int) gmode);
+    fprintf(f, "stm %d\n", stm);
+    for (y = 0; y < 9; y++) {
+        for (x = 0; x < 8; x++)
+            fprintf(f, "%2d ", start[y][x]);
+        fprintf(f, "\n");
+    }
+    fprintf(f, "depth %u\n", depth);
+    fprintf(f, "value %d\n", tree->best);
+    fprintf(f, "nodes %llu\n", nodes);
+    fprintf(f, "elapsed %d\n", elapsed.seconds);
+    fprintf(f, "pv %u\n", tree->bl_len);
+    for (i = 0; i < tree->bl_len; i++)
+        fprintf(f, "%d %d %d %d %d\n", tree->best_line[i][0], tree->best_line[i][1], \
+            tree->best_line[i][2], tree->best_line[i][3], tree->best_line[i][4]);
+    fprintf(f, "multipv %u\n", npvs);
+    for (j = 0; j < npvs; j++) {
+        fprintf(f, "%d %u\n", mpv_value[j], mpv_len[j]);
+        for (k = 0; k < mpv_len[j]; k++)
+            fprintf(f, "%d %d %d %d %d\n", mpv_line[j][k][0], mpv_line[j][k][1], \
+                mpv_line[j][k][2], mpv_line[j][k][3], mpv_line[j][k][4]);
+    }
+    // Root order for the next iteration: the variations, then the moves of
+    // the last pass by score
+    for (j = 0; j < npvs; j++) {
+        copy_move(mpv_line[j][0], moves[n]);
+        values[n++] = mpv_value[j];
+    }
+    for (i = 0; i < tree->max_index; i++) {
+        for (j = 0; j < npvs; j++)
+        if (!move_cmp(tree->legal_moves[i], mpv_line[j][0]))
+            break;
+        if (j < npvs)
+            continue;
+        for (j = n; j > npvs && values[j - 1] < tree->valuelist[i]; j--) {
+            copy_move(moves[j - 1], moves[j]);
+            values[j] = values[j - 1];
+        }
+        copy_move(tree->legal_moves[i], moves[j]);
+        values[j] = tree->valuelist[i];
+        n++;
+    }
+    fprintf(f, "root %u\n", n);
+    for (i = 0; i < n; i++)
+        fprintf(f, "%d %d %d %d %d %d\n", moves[i][0], moves[i][1], moves[i][2], \
+            moves[i][3], moves[i][4], values[i]);
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    rename(tmpname, name);
+}
+
+LEVEL checkpoint_load(const char *name, BOARD start)
+// Returns the first depth still to be searched
+{
+    FILE *f;
+    TREE *tree = &treea[0];
+    char buf[80];
+    MOVEINDEX i;
+    LEVEL k;
+    int mode;
+    int version;
+    LEVEL depth;
+    u5 x;
+    u5 y;
+    f = fopen(name, "r");
+    if (!f) {
+        warn("Cannot open checkpoint file for read");
+        exit(1);
+    }
+    if (fscanf(f, " checkpoint %d", &version) != 1 || version != _CKPTVERSION)
+        goto bad;
+    if (fscanf(f, " mode %d stm %d", &mode, &stm) != 2)
+        goto bad;
+    gmode = (MODES) mode;
+    for (y = 0; y < 9; y++)
+    for (x = 0; x < 8; x++)
+    if (fscanf(f, "%hhd", &start[y][x]) != 1)
+        goto bad;
+    if (fscanf(f, " depth %u value %d nodes %llu elapsed %d", \
+        &depth, &tree->best, &nodes, &elapsed.seconds) != 4)
+        goto bad;
+    if (fscanf(f, " pv %u", &tree->bl_len) != 1 || tree->bl_len > _MAXLEVEL)
+        goto bad;
+    for (i = 0; i < tree->bl_len; i++) {
+        tree->best_line[i][5] = 0;
+        if (fscanf(f, "%d %d %d %d %d", &tree->best_line[i][0], &tree->best_line[i][1], \
+            &tree->best_line[i][2], &tree->best_line[i][3], &tree->best_line[i][4]) != 5)
+            goto bad;
+    }
+    if (fscanf(f, " multipv %u", &npvs) != 1 || npvs > _MAXMULTIPV)
+        goto bad;
+    for (i = 0; i < npvs; i++) {
+        if (fscanf(f, "%d %u", &mpv_value[i], &mpv_len[i]) != 2 || mpv_len[i] > _MAXLEVEL)
+            goto bad;
+        for (k = 0; k < mpv_len[i]; k++) {
+            mpv_line[i][k][5] = 0;
+            if (fscanf(f, "%d %d %d %d %d", &mpv_line[i][k][0], &mpv_line[i][k][1], \
+                &mpv_line[i][k][2], &mpv_line[i][k][3], &mpv_line[i][k][4]) != 5)
+                goto bad;
+        }
+    }
+    if (npvs > gmultipv)
+        npvs = gmultipv;
+    if (fscanf(f, " root %u", &tree->max_index) != 1 || tree->max_index > _MAXINDEX)
+        goto bad;
+    for (i = 0; i < tree->max_index; i++) {
+        tree->legal_moves[i][5] = 0;
+        if (fscanf(f, "%d %d %d %d %d %d", &tree->legal_moves[i][0], &tree->legal_moves[i][1], \
+            &tree->legal_moves[i][2], &tree->legal_moves[i][3], &tree->legal_moves[i][4], \
+            &tree->valuelist[i]) != 6)
+            goto bad;
+    }
+    fclose(f);
+    score_board(start);
+    if (tree->bl_len)
+        copy_move(tree->best_line[0], best_move);
+    // The first iteration after the resume starts from the saved root order
+    memcpy(rootorder, tree->legal_moves, tree->max_index * sizeof(MOVE));
+    nrootorder = tree->max_index;
+    gseeded = 1;
+    pvsready = 1;
+    ckpttime = elapsed.seconds;
+    if (gmode == ANALYSIS)
+    if (!gjson) {
+        fprintf(stdout, "Resuming after depth %u\n", depth);
+        for (i = 0; i < tree->max_index; i++) {
+            show_move(tree->legal_moves[i], start, stm % 2, buf);
+            fprintf(stdout, "%s %.2lf\n", buf, 0.01 * (double) tree->valuelist[i]);
+        }
+        fprintf(stdout, "\n");
+        fflush(stdout);
+    }
+    return (depth + 1);
+bad:
+    warn("Bad checkpoint file");
+    fclose(f);
+    exit(1);
+}
+
+static inline void nnue_add(int16_t *acc, const int16_t *w, u5 n)
+{
+    u5 i;
+#if defined(__AVX2__)
+    for (i = 0; i < n; i += 16)
+        _mm256_store_si256((__m256i *) (acc + i), _mm256_add_epi16( \
+            _mm256_load_si256((__m256i *) (acc + i)), _mm256_load_si256((__m256i *) (w + i))));
+#elif defined(__SSSE3__)
+    for (i = 0; i < n; i += 8)
+        _mm_store_si128((__m128i *) (acc + i), _mm_add_epi16( \
+            _mm_load_si128((__m128i *) (acc + i)), _mm_load_si128((__m128i *) (w + i))));
+#else
+    for (i = 0; i < n; i++)
+        acc[i] += w[i];
+#endif
+}
+
+static inline void nnue_sub(int16_t *acc, const int16_t *w, u5 n)
+{
+    u5 i;
+#if defined(__AVX2__)
+    for (i = 0; i < n; i += 16)
+        _mm256_store_si256((__m256i *) (acc + i), _mm256_sub_epi16( \
+            _mm256_load_si256((__m256i *) (acc + i)), _mm256_load_si256((__m256i *) (w + i))));
+#elif defined(__SSSE3__)
+    for (i = 0; i < n; i += 8)
+        _mm_store_si128((__m128i *) (acc + i), _mm_sub_epi16( \
+            _mm_load_si128((__m128i *) (acc + i)), _mm_load_si128((__m128i *) (w + i))));
+#else
+    for (i = 0; i < n; i++)
+        acc[i] -= w[i];
+#endif
+}
+
+static inline s5 nnue_dot(const int16_t *acc, const int8_t *w, u5 n)
+// Sum of clamp(acc, 0, 127) * w
+{
+    u5 i;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i top = _mm256_set1_epi16(127);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (i = 0; i < n; i += 32) {
+        __m256i a = _mm256_load_si256((__m256i *) (acc + i));
+        __m256i b = _mm256_load_si256((__m256i *) (acc + i + 16));
+        a = _mm256_min_epi16(_mm256_max_epi16(a, zero), top);
+        b = _mm256_min_epi16(_mm256_max_epi16(b, zero), top);
+        // packus works per 128-bit lane, the permute restores the order
+        __m256i u = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+        __m256i p = _mm256_maddubs_epi16(u, _mm256_loadu_si256((__m256i *) (w + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    return (_mm_cvtsi128_si32(s));
+#elif defined(__SSSE3__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top = _mm_set1_epi16(127);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for (i = 0; i < n; i += 16) {
+        __m128i a = _mm_load_si128((__m128i *) (acc + i));
+        __m128i b = _mm_load_si128((__m128i *) (acc + i + 8));
+        a = _mm_min_epi16(_mm_max_epi16(a, zero), top);
+        b = _mm_min_epi16(_mm_max_epi16(b, zero), top);
+        __m128i p = _mm_maddubs_epi16(_mm_packus_epi16(a, b), _mm_loadu_si128((__m128i *) (w + i)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(p, ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return (_mm_cvtsi128_si32(sum));
+#else
+    s5 sum = 0;
+    for (i = 0; i < n; i++) {
+        s5 a = acc[i];
+        if (a < 0) a = 0;
+        if (a > 127) a = 127;
+        sum += a * w[i];
+    }
+    return (sum);
+#endif
+}
+
+static inline u5 nnue_feature(s3 piece, u5 sq)
+// White pieces 0..5, black pieces 6..11, as seen by the side to move
+{
+    return (((piece > 0) ? (piece - 1) : (5 - piece)) * 64 + sq);
+}
+
+int nnue_load(const char *name)
+// Header: magic, version, hidden, divisor, output bias;
+// then int16 ft_bias[hidden], int16 ft_weights[768][hidden], int8 out_weights[2][hidden]
+{
+    FILE *f;
+    u5 header[5];
+    size_t wsize;
+    f = fopen(name, "rb");
+    if (!f) {
+        warn("Cannot open network file, using the handcrafted eval");
+        return (0);
+    }
+    if (fread(header, sizeof(header), 1, f) != 1 || \
+        header[0] != _NNUEMAGIC || header[1] != _NNUEVERSION || \
+        header[2] == 0 || header[2] > _NNUE_MAXH || (header[2] & 31) || \
+        (s5) header[3] <= 0) {
+        warn("Bad network file, using the handcrafted eval");
+        fclose(f);
+        return (0);
+    }
+    network.hidden = header[2];
+    network.divisor = (s5) header[3];
+    network.out_bias = (s5) header[4];
+    wsize = (size_t) _NNUE_INPUTS * network.hidden * sizeof(int16_t);
+    network.ft_bias = (int16_t *) aligned_alloc(32, network.hidden * sizeof(int16_t));
+    network.ft_weights = (int16_t *) aligned_alloc(32, wsize);
+    network.out_weights = (int8_t *) aligned_alloc(32, 2 * network.hidden);
+    if (!network.ft_bias || !network.ft_weights || !network.out_weights) {
+        warn("Out of memory");
+        exit(1);
+    }
+    if (fread(network.ft_bias, sizeof(int16_t), network.hidden, f) != network.hidden || \
+        fread(network.ft_weights, 1, wsize, f) != wsize || \
+        fread(network.out_weights, 1, 2 * network.hidden, f) != 2 * network.hidden) {
+        warn("Truncated network file, using the handcrafted eval");
+        fclose(f);
+        return (0);
+    }
+    fclose(f);
+    return (1);
+}
+
+void nnue_refresh(ACCUMULATOR *acc, BOARD board)
+{
+    u5 h = network.hidden;
+    u5 x;
+    u5 y;
+    memcpy(acc->v[0], network.ft_bias, h * sizeof(int16_t));
+    memcpy(acc->v[1], network.ft_bias, h * sizeof(int16_t));
+    for (y = 0; y < 8; y++)
+    for (x = 0; x < 8; x++)
+    if (board[y][x]) {
+        u5 sq = (y << 3) | x;
+        nnue_add(acc->v[0], network.ft_weights + nnue_feature(board[y][x], sq) * h, h);
+        nnue_add(acc->v[1], network.ft_weights + nnue_feature(-board[y][x], sq ^ 56) * h, h);
+    }
+}
+
+u6 nnue_parent(BOARD board)
+// Raw key of the board makemove() started from, undone from the change log
+{
+    u6 keys[2];
+    u5 d;
+    memcpy(keys, STATE(board)->key, sizeof(keys));
+    for (d = 0; d < 4; d++)
+    if (STATE(board)->dirty[d]) {
+        u5 c = STATE(board)->dirty[d] - 1;
+        keys[1] ^= zobrist[(c >> 6) & 15][c & 63] ^ zobrist[(c >> 10) & 15][c & 63];
+    }
+    return (keys[1]);
+}
+
+void nnue_update(ACCUMULATOR *parent, ACCUMULATOR *acc, BOARD board)
+// The log is in the parent's orientation; transpose() swapped the perspectives
+{
+    u5 h = network.hidden;
+    u5 d;
+    memcpy(acc->v[0], parent->v[1], h * sizeof(int16_t));
+    memcpy(acc->v[1], parent->v[0], h * sizeof(int16_t));
+    for (d = 0; d < 4; d++)
+    if (STATE(board)->dirty[d]) {
+        u5 c = STATE(board)->dirty[d] - 1;
+        u5 sq = c & 63;
+        s3 old = (s3) ((c >> 6) & 15) - 6;
+        s3 piece = (s3) ((c >> 10) & 15) - 6;
+        if (old) {
+            nnue_sub(acc->v[1], network.ft_weights + nnue_feature(old, sq) * h, h);
+            nnue_sub(acc->v[0], network.ft_weights + nnue_feature(-old, sq ^ 56) * h, h);
+        }
+        if (piece) {
+            nnue_add(acc->v[1], network.ft_weights + nnue_feature(piece, sq) * h, h);
+            nnue_add(acc->v[0], network.ft_weights + nnue_feature(-piece, sq ^ 56) * h, h);
+        }
+    }
+}
+
+VALUE nnue_eval(BOARD board, LEVEL level)
+// Accumulators are kept per tree and level; a child is updated from its
+// parent when the parent's key matches, otherwise rebuilt from the board
+{
+    ACCUMULATOR *acc = &accstack[gstack][level];
+    ACCUMULATOR *parent = NULL;
+    u6 key;
+    memcpy(&key, STATE(board)->key, sizeof(key));
+    if (acc->key != key) {
+        if (level)
+            parent = &accstack[gstack][level - 1];
+        else if (gstack)
+            parent = &accstack[0][glevel];
+        if (parent && parent->key == nnue_parent(board))
+            nnue_update(parent, acc, board);
+        else
+            nnue_refresh(acc, board);
+        acc->key = key;
+    }
+    return ((network.out_bias + nnue_dot(acc->v[0], network.out_weights, network.hidden) + \
+        nnue_dot(acc->v[1], network.out_weights + network.hidden, network.hidden)) / network.divisor);
+}
+
+VALUE tune_static(BOARD board)
+// Material, PST and pawns for the side to move, without the shared pawn table
+{
+    BOARD aux;
+    copy_board(board, aux);
+    transpose(aux);
+    return (STATE(board)->score + pawn_side(board) - pawn_side(aux));
+}
+
+VALUE tune_quiesce(BOARD board, VALUE alpha, VALUE beta, LEVEL ply, BOARD leaf, s5 *sign)
+// Captures only, most valuable victim first; leaf gets the quiet position
+// at the end of the line and sign its side to move relative to board
+{
+    BOARD next;
+    BOARD best;
+    MOVELIST movelist;
+    MOVEINDEX max_index;
+    MOVEINDEX i;
+    MOVEINDEX j;
+    s5 bsign = 1;
+    s5 nsign;
+    VALUE value = tune_static(board);
+    copy_board(board, leaf);
+    *sign = 1;
+    if (value >= beta || ply >= _TUNE_QPLY)
+        return (value);
+    if (value > alpha)
+        alpha = value;
+    max_index = gendeep(board, movelist, 0);
+    // Keep the captures, sorted by victim
+    for (i = j = 0; i < max_index; i++)
+    if (board[(u5) movelist[i][2]][(u5) movelist[i][3]] < 0) {
+        if (board[(u5) movelist[i][2]][(u5) movelist[i][3]] == _BK)
+            return (_MAXVALUE - ply);
+        copy_move(movelist[i], movelist[j++]);
+    }
+    max_index = j;
+    for (i = 1; i < max_index; i++)
+    for (j = i; j > 0 && board[(u5) movelist[j][2]][(u5) movelist[j][3]] < \
+        board[(u5) movelist[j - 1][2]][(u5) movelist[j - 1][3]]; j--) {
+        MOVE t;
+        copy_move(movelist[j], t);
+        copy_move(movelist[j - 1], movelist[j]);
+        copy_move(t, movelist[j - 1]);
+    }
+    for (i = 0; i < max_index; i++) {
+        makemove(board, movelist[i], next);
+        value = -tune_quiesce(next, -beta, -alpha, ply + 1, best, &nsign);
+        if (value > alpha) {
+            alpha = value;
+            copy_board(best, leaf);
+            bsign = -nsign;
+            if (alpha >= beta)
+                break;
+        }
+    }
+    *sign = bsign;
+    return (alpha);
+}
+
+void tune_features(BOARD board, s5 sign, TUNEPOS *pos)
+// Splits tune_static(board) into fixed terms and parameter coefficients,
+// multiplied by sign so that they are for White
+{
+    BOARD aux;
+    s4 terms[2][11] = { { 0 } };
+    s4 x[_NPARAMS];
+    u5 sq;
+    u5 i;
+    memset(x, 0, sizeof(x));
+    pos->base = 0;
+    for (sq = 0; sq < 64; sq++) {
+        s3 piece = board[sq >> 3][sq & 7];
+        if (!piece)
+            continue;
+        s5 own = (piece > 0) ? 1 : -1;
+        u5 rel = (piece > 0) ? sq : sq ^ 56;
+        piece *= own;
+        pos->base += own * _CENTRE[rel];
+        if (piece == _WP)
+            x[4 + (rel >> 3)] += own;
+        else if (piece != _WK)
+            x[piece - 1] += own;
+    }
+    copy_board(board, aux);
+    transpose(aux);
+    pawn_terms(board, terms[0]);
+    pawn_terms(aux, terms[1]);
+    for (i = 1; i < 7; i++)
+        x[10 + i] = terms[0][i] - terms[1][i];
+    x[17] = terms[1][8] - terms[0][8];
+    x[18] = terms[1][10] - terms[0][10];
+    x[19] = terms[1][9] - terms[0][9];
+    // Parameters not tuned go into the fixed part
+    for (i = 0; i < _NPARAMS; i++) {
+        if (!params[i].tune)
+            pos->base += x[i] * *params[i].value;
+        pos->x[i] = params[i].tune ? sign * x[i] : 0;
+    }
+    pos->base *= sign;
+}
+
+void *tune_load_range(void *arg)
+// Parses and quiesces one slice of the input lines
+{
+    TUNEJOB *job = (TUNEJOB *) arg;
+    BOARD board;
+    BOARD leaf;
+    u6 i;
+    s5 side;
+    s5 sign;
+    job->kept = 0;
+    for (i = 0; i < job->count; i++) {
+        const char *line = job->lines[i];
+        float result;
+        const char *r;
+        if (!fen_board(line, board, &side, NULL))
+            continue;
+        if ((r = strstr(line, "1/2-1/2")) || (r = strstr(line, "[0.5]")))
+            result = 0.5;
+        else if ((r = strstr(line, "1-0")) || (r = strstr(line, "[1.0]")) || (r = strstr(line, "[1]")))
+            result = 1.0;
+        else if ((r = strstr(line, "0-1")) || (r = strstr(line, "[0.0]")) || (r = strstr(line, "[0]")))
+            result = 0.0;
+        else
+            continue;
+        if (side)
+            transpose(board);
+        VALUE value = tune_quiesce(board, -_MAXVALUE, _MAXVALUE, 0, leaf, &sign);
+        if (value > _THRESHOLD || value < -_THRESHOLD)
+            continue;
+        TUNEPOS *pos = &job->pos[job->kept++];
+        tune_features(leaf, side ? -sign : sign, pos);
+        pos->result = result;
+    }
+    return (NULL);
+}
+
+void *tune_error_range(void *arg)
+// Squared error of one slice and its gradient in the parameters
+{
+    TUNEJOB *job = (TUNEJOB *) arg;
+    u6 i;
+    u5 p;
+    double scale = job->k * log(10.0) / 400.0;
+    job->error = 0;
+    memset(job->grad, 0, sizeof(job->grad));
+    for (i = 0; i < job->kept; i++) {
+        TUNEPOS *pos = &job->pos[i];
+        double e = pos->base;
+        for (p = 0; p < _NPARAMS; p++)
+            e += job->weight[p] * pos->x[p];
+        double q = 1.0 / (1.0 + exp(-scale * e));
+        double d = pos->result - q;
+        job->error += d * d;
+        double g = -2.0 * d * q * (1.0 - q) * scale;
+        for (p = 0; p < _NPARAMS; p++)
+            job->grad[p] += g * pos->x[p];
+    }
+    return (NULL);
+}
+
+double tune_error(TUNEJOB *jobs, s5 n, double *weight, double k, double *grad)
+{
+    pthread_t threads[n];
+    double error = 0;
+    u6 count = 0;
+    s5 t;
+    u5 p;
+    for (t = 0; t < n; t++) {
+        jobs[t].weight = weight;
+        jobs[t].k = k;
+        pthread_create(&threads[t], NULL, tune_error_range, &jobs[t]);
+    }
+    if (grad)
+        memset(grad, 0, _NPARAMS * sizeof(double));
+    for (t = 0; t < n; t++) {
+        pthread_join(threads[t], NULL);
+        error += jobs[t].error;
+        count += jobs[t].kept;
+        if (grad)
+        for (p = 0; p < _NPARAMS; p++)
+            grad[p] += jobs[t].grad[p];
+    }
+    if (grad)
+    for (p = 0; p < _NPARAMS; p++)
+        grad[p] /= count;
+    return (error / count);
+}
+
+int tune(const char *name)
+// Texel tuning: quiet leaves of labelled EPD positions, the logistic scale
+// fitted first, then Adam on the mean squared error of the static eval
+{
+    FILE *f;
+    char *lines[_TUNE_BLOCK];
+    char (*text)[512];
+    TUNEPOS *pos = NULL;
+    TUNEPOS *grown;
+    u6 nlines = 0;
+    u6 block;
+    u6 cap = 0;
+    u6 kept = 0;
+    u6 i;
+    s5 n = gthreads;
+    s5 t;
+    u5 p;
+    u5 iter;
+    double weight[_TUNE_MAXPARAMS];
+    double grad[_TUNE_MAXPARAMS];
+    double m[_TUNE_MAXPARAMS] = { 0 };
+    double v[_TUNE_MAXPARAMS] = { 0 };
+    double k;
+    double lo = 0.1;
+    double hi = 5.0;
+    ELAPSED clock;
+    f = fopen(name, "r");
+    if (!f) {
+        warn("Cannot open tuning file");
+        return (1);
+    }
+    if (n < 1)
+        n = (s5) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    TUNEJOB jobs[n];
+    pthread_t threads[n];
+    text = malloc(_TUNE_BLOCK * sizeof(*text));
+    if (!text) {
+        warn("Out of memory");
+        fclose(f);
+        return (1);
+    }
+    for (i = 0; i < _TUNE_BLOCK; i++)
+        lines[i] = text[i];
+    init(&clock);
+    // Only the quiet leaves are kept: the text is read a block at a time
+    for (;;) {
+        for (block = 0; block < _TUNE_BLOCK && fgets(text[block], sizeof(*text), f); block++)
+            ;
+        if (!block)
+            break;
+        nlines += block;
+        if (kept + block > cap) {
+            cap = 2 * (kept + block);
+            grown = (TUNEPOS *) realloc(pos, cap * sizeof(TUNEPOS));
+            if (!grown) {
+                warn("Out of memory");
+                free(pos);
+                free(text);
+                fclose(f);
+                return (1);
+            }
+            pos = grown;
+        }
+        for (t = 0; t < n; t++) {
+            u6 from = block * t / n;
+            jobs[t].lines = lines + from;
+            jobs[t].pos = pos + kept + from;
+            jobs[t].count = block * (t + 1) / n - from;
+            pthread_create(&threads[t], NULL, tune_load_range, &jobs[t]);
+        }
+        for (t = 0; t < n; t++) {
+            pthread_join(threads[t], NULL);
+            memmove(pos + kept, jobs[t].pos, jobs[t].kept * sizeof(TUNEPOS));
+            kept += jobs[t].kept;
+        }
+    }
+    fclose(f);
+    free(text);
+    // The error is then summed over equal slices of the positions
+    for (t = 0; t < n; t++) {
+        jobs[t].pos = pos + kept * t / n;
+        jobs[t].kept = kept * (t + 1) / n - kept * t / n;
+    }
+    update(&clock);
+    fprintf(stdout, "Positions: %llu of %llu, %d threads, %.2lf s\n", kept, nlines, n, dclock(&clock));
+    if (!kept) {
+        warn("No labelled positions");
+        return (1);
+    }
+    for (p = 0; p < _NPARAMS; p++)
+        weight[p] = *params[p].value;
+    // Golden section search for the scale that fits the current values
+    while (hi - lo > 0.001) {
+        double a = hi - (hi - lo) / 1.618034;
+        double b = lo + (hi - lo) / 1.618034;
+        if (tune_error(jobs, n, weight, a, NULL) < tune_error(jobs, n, weight, b, NULL))
+            hi = b;
+        else
+            lo = a;
+    }
+    k = (lo + hi) / 2;
+    fprintf(stdout, "K: %.3lf\nError: %.6lf\n", k, tune_error(jobs, n, weight, k, NULL));
+    fflush(stdout);
+    for (iter = 1; iter <= (giterations ? (u5) giterations : _TUNE_ITER); iter++) {
+        double error = tune_error(jobs, n, weight, k, grad);
+        for (p = 0; p < _NPARAMS; p++)
+        if (params[p].tune) {
+            m[p] = 0.9 * m[p] + 0.1 * grad[p];
+            v[p] = 0.999 * v[p] + 0.001 * grad[p] * grad[p];
+            double mh = m[p] / (1 - pow(0.9, iter));
+            double vh = v[p] / (1 - pow(0.999, iter));
+            weight[p] -= _TUNE_RATE * mh / (sqrt(vh) + 1e-12);
+        }
+        if (iter % 100 == 0) {
+            fprintf(stdout, "Iteration %u: error %.6lf\n", iter, error);
+            fflush(stdout);
+        }
+    }
+    for (p = 0; p < _NPARAMS; p++)
+        *params[p].value = (VALUE) lround(weight[p]);
+    save_params(outfile ? outfile : "tune.bpf");
+    for (p = 0; p < _NPARAMS; p++)
+        fprintf(stdout, "%s %d\n", params[p].name, *params[p].value);
+    update(&clock);
+    fprintf(stdout, "Error: %.6lf\nElapsed: %.2lf\n", tune_error(jobs, n, weight, k, NULL), dclock(&clock));
+    free(pos);
+    return (0);
+}
+
+MOVEINDEX legal_moves(BOARD board, MOVELIST movelist)
+// Moves that do not leave the king en prise
+{
+    BOARD aux;
+    MOVELIST all;
+    MOVEINDEX max_index = gendeep(board, all, 1);
+    MOVEINDEX curr_index;
+    MOVEINDEX n = 0;
+    for (curr_index = 0; curr_index < max_index; curr_index++) {
+        makemove(board, all[curr_index], aux);
+        transpose(aux);
+        if (!in_check(aux))
+            copy_move(all[curr_index], movelist[n++]);
+    }
+    return (n);
+}
+
+int think(BOARD board, MOVE move, VALUE *value)
+// Iterative deepening from depth 1 until gnodelimit, gdeadline or
+// --max-depth; move and value come from the last completed iteration, or
+// move is the first ordered root move if none completed, in which case 0
+// is returned. gabort is cleared on return, so a stop that arrives before
+// the search starts is not lost.
+{
+    int done;
+    VALUE best;
+    nodes = 0;
+    pvsready = 0;
+    gcompleted = 0;
+    treea[0].best = -_MAXVALUE;
+    treea[0].bl_len = 0;
+    best_move[0] = -1;
+    best = deepen(board, 1, (gmaxdepth > 0) ? min(gmaxdepth + 1, _MAXLEVEL) : _MAXLEVEL_GO);
+    if (value)
+        *value = best;
+    done = (best_move[0] >= 0);
+    if (!done)
+        copy_move(treea[0].legal_moves[0], best_move);
+    copy_move(best_move, move);
+    gabort = 0;
+    return (done);
+}
+
+int epd_batch(const char *name)
+// One search per FEN or EPD line of `name', or of stdin for "-", each
+// limited by --max-depth, --nodes and --time. Prints the position back as
+// EPD with the best move, score, depth, nodes and seconds. The hash table
+// stays warm from one position to the next.
+{
+    FILE *f;
+    char line[512];
+    char fen[128];
+    char san[16];
+    BOARD board;
+    MOVE move;
+    VALUE value;
+    s5 side;
+    s5 moveno;
+    s5 n = 0;
+    f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+    if (!f) {
+        warn("Cannot open batch file");
+        return (1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0] || line[0] == '#')
+            continue;
+        if (!fen_board(line, board, &side, &moveno)) {
+            fprintf(stdout, "%s; error bad position\n", line);
+            fflush(stdout);
+            continue;
+        }
+        if (side)
+            transpose(board);
+        stm = side;
+        board_fen(board, side, moveno, fen);
+        // Placement, side, castling and en passant: the EPD fields
+        *strrchr(fen, ' ') = 0;
+        *strrchr(fen, ' ') = 0;
+        if (!legal_moves(board, treea[0].legal_moves)) {
+            fprintf(stdout, "%s; error no legal moves\n", fen);
+            fflush(stdout);
+            continue;
+        }
+        init(&elapsed);
+        gdeadline = gtimelimit;
+        think(board, move, &value);
+        update(&elapsed);
+        move_san(board, side, move, san);
+        fprintf(stdout, "%s bm %s; ce %d; acd %u; acn %llu; acs %.2lf;\n", \
+            fen, san, value, gcompleted, nodes, dclock(&elapsed));
+        fflush(stdout);
+        n++;
+    }
+    if (f != stdin)
+        fclose(f);
+    gdeadline = 0;
+    return (n ? 0 : 1);
+}
+
+const char *bench_fens[] = {
+    // Start position and the end of pgn/bench.pgn
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "7r/3r1k2/5p1p/2bPp1p1/6P1/2P3B1/PP3PP1/2KR3R w - - 1 27",
+    // Middlegames
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP1B1PPP/R2QKB1R w KQ - 0 8",
+    "r1bqkb1r/pp3ppp/2np1n2/4p3/3NP3/2N5/PPP2PPP/R1BQKB1R w KQkq - 0 6",
+    "r2q1rk1/ppp2ppp/2n1bn2/2b1p3/3pP3/3P1NPP/PPP1NPB1/R1BQ1RK1 b - - 0 9",
+    "r1bq1rk1/pppnnppp/4p3/3pP3/1b1P4/2NB1N2/PPP2PPP/R1BQK2R w KQ - 3 7",
+    "2rq1rk1/pp1bppbp/3p1np1/4n3/3NP2P/1BN1BP2/PPPQ2P1/2KR3R b - - 0 13",
+    "r1b2rk1/2q1b1pp/p2ppn2/1p6/3QP3/1BN1B3/PPP3PP/R4RK1 w - - 0 14",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    // Endgames
+    "8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
+    "8/8/1p1k4/5ppp/PPK1p3/6P1/5PP1/8 b - - 0 40",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "8/8/4k3/3n4/8/1K2B3/8/8 w - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+};
+
+int bench(s5 depth)
+// Searches bench_fens to `depth' from a cleared hash table, so that the
+// total node count, eval noise included, is the same from run to run and
+// is a signature of the search. NPS is the figure to compare across builds.
+{
+    BOARD board;
+    MOVE move;
+    VALUE value;
+    char san[16];
+    s5 side;
+    s5 moveno;
+    u5 i;
+    u5 n = sizeof(bench_fens) / sizeof(bench_fens[0]);
+    NODES total = 0;
+    double seconds = 0;
+    gmaxdepth = depth;
+    gdeadline = 0;
+    for (i = 0; i < n; i++) {
+        if (!fen_board(bench_fens[i], board, &side, &moveno)) {
+            warn("Bad bench position");
+            return (1);
+        }
+        if (side)
+            transpose(board);
+        stm = side;
+        legal_moves(board, treea[0].legal_moves);
+        memset(hashtable, 0, (1 << ghashbits) * sizeof(HASHENTRY));
+        init(&elapsed);
+        think(board, move, &value);
+        update(&elapsed);
+        move_san(board, side, move, san);
+        fprintf(stdout, "Position %u/%u: %s %d, %llu nodes\n", i + 1, n, san, value, nodes);
+        fflush(stdout);
+        total += nodes;
+        seconds += dclock(&elapsed);
+    }
+    fprintf(stdout, "\nDepth: %d\n", depth);
+    fprintf(stdout, "Nodes: %llu\n", total);
+    fprintf(stdout, "Elapsed: %.2lf\n", seconds);
+    fprintf(stdout, "NPS: %u\n", (unsigned int) ((double) total / (seconds + !seconds)));
+    return (0);
+}
+
+const char *micro_names[] = {
+    "copy_board", "transpose", "makemove", "in_check", "genFast", "gendeep", "eval",
+};
+
+u6 micro_run(u5 prim, BOARD *boards, MOVE *moves, u5 n, u5 ops)
+// `ops' calls of one primitive over the n positions. Every result is
+// folded into the returned sum, so none of the calls can be left out.
+{
+    BOARD aux;
+    MOVELIST movelist;
+    u6 sum = 0;
+    u5 i = 0;
+    u5 k;
+    for (k = 0; k < ops; k++, i = (i + 1 < n) ? i + 1 : 0)
+    switch (prim) {
+    case 0:
+        copy_board(boards[i], aux);
+        sum += aux[k & 7][i & 7];
+        break;
+    case 1:
+        transpose(boards[i]);
+        sum += boards[i][k & 7][i & 7];
+        break;
+    case 2:
+        makemove(boards[i], moves[i], aux);
+        sum += STATE(aux)->score;
+        break;
+    case 3:
+        sum += in_check(boards[i]);
+        break;
+    case 4:
+        sum += genFast(boards[i]);
+        break;
+    case 5:
+        sum += gendeep(boards[i], movelist, 1);
+        sum += movelist[0][2];
+        break;
+    default:
+        sum += eval(boards[i], 1);
+    }
+    return (sum);
+}
+
+int micro(void)
+// Times the primitives of the search one at a time, in ns per call: mean
+// and standard deviation over the rounds, and the fastest round. The sums
+// of all rounds of a primitive must agree, or the work was not done.
+{
+    BOARD *boards;
+    BOARD *work;
+    MOVE *moves;
+    BOARD board;
+    BOARD next;
+    MOVELIST movelist;
+    struct timespec t0;
+    struct timespec t1;
+    u6 seed = 0x9e3779b97f4a7c15ULL;
+    u6 sum;
+    u6 check;
+    s5 side;
+    s5 moveno;
+    MOVEINDEX count;
+    u5 rounds = giterations ? (u5) giterations : _MICRO_ROUNDS;
+    u5 nfens = sizeof(bench_fens) / sizeof(bench_fens[0]);
+    u5 n = 0;
+    u5 prim;
+    u5 r;
+    boards = aligned_alloc(64, _MICRO_POSITIONS * sizeof(BOARD));
+    work = aligned_alloc(64, _MICRO_POSITIONS * sizeof(BOARD));
+    moves = malloc(_MICRO_POSITIONS * sizeof(MOVE));
+    if (!boards || !work || !moves) {
+        warn("Out of memory");
+        return (1);
+    }
+    while (n < _MICRO_POSITIONS) {
+        fen_board(bench_fens[n % nfens], board, &side, &moveno);
+        if (side)
+            transpose(board);
+        while (n < _MICRO_POSITIONS) {
+            count = legal_moves(board, movelist);
+            if (!count)
+                break;
+            copy_board(board, boards[n]);
+            copy_move(movelist[hash_rand(&seed) % count], moves[n]);
+            makemove(board, moves[n++], next);
+            copy_board(next, board);
+            if (hash_rand(&seed) % 64 == 0)
+                break;
+        }
+    }
+    fprintf(stdout, "Positions: %u\nRounds: %u of %u calls, eval %u\n\n", n, rounds, _MICRO_OPS, n);
+    fprintf(stdout, "%-12s %10s %10s %10s  %s\n", "Primitive", "ns/op", "stddev", "min", "sum");
+    for (prim = 0; prim < sizeof(micro_names) / sizeof(micro_names[0]); prim++) {
+        double mean = 0;
+        double var = 0;
+        double best = 0;
+        check = 0;
+        // eval() sees each position once per round, with empty pawn and
+        // eval caches, at a node that probes checks and captures
+        u5 ops = (prim == _MICRO_EVAL) ? n : _MICRO_OPS;
+        treea[1].depth = 2;
+        treea[1].alpha = _MAXVALUE;
+        memcpy(work, boards, n * sizeof(BOARD));
+        micro_run(prim, work, moves, n, ops);
+        for (r = 0; r < rounds; r++) {
+            // transpose() works in place; every round starts from the same positions
+            memcpy(work, boards, n * sizeof(BOARD));
+            if (prim == _MICRO_EVAL) {
+                memset(pawntable, 0, sizeof(pawntable));
+                memset(evaltable, 0, sizeof(evaltable));
+                nodes = 0;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            sum = micro_run(prim, work, moves, n, ops);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double ns = ((double) (t1.tv_sec - t0.tv_sec) * 1e9 + \
+                (double) (t1.tv_nsec - t0.tv_nsec)) / ops;
+            // Welford's running mean and variance
+            double delta = ns - mean;
+            mean += delta / (r + 1);
+            var += delta * (ns - mean);
+            if (!r || ns < best)
+                best = ns;
+            if (r && sum != check)
+                warn("Micro sums differ between rounds");
+            check = sum;
+        }
+        fprintf(stdout, "%-12s %10.2lf %10.2lf %10.2lf  %016llx\n", micro_names[prim], mean, \
+            sqrt(var / (rounds > 1 ? rounds - 1 : 1)), best, check);
+        fflush(stdout);
+    }
+    free(boards);
+    free(work);
+    free(moves);
+    return (0);
+}
+
+BOARD uciboard;
+s5 ucistm;
+// ucistop, uciinfinite and uciponder are shared with the search thread
+// under ucilock; ucicond wakes a finished search waiting to send bestmove
+pthread_mutex_t ucilock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ucicond = PTHREAD_COND_INITIALIZER;
+int ucistop; // stop or quit seen since the last go
+int uciinfinite;
+int uciponder;
+double ucibudget; // Seconds for the move of a `go ponder', used on ponderhit
+ELAPSED ucigo; // Since the last go, kept by the UCI thread alone
+
+void *uci_search(void *arg)
+// Search thread of the UCI front end; under `go infinite' bestmove waits
+// for stop, as the protocol asks
+{
+    MOVE move;
+    VALUE value;
+    char buf[8];
+    (void) arg;
+    if (legal_moves(uciboard, treea[0].legal_moves)) {
+        think(uciboard, move, &value);
+        move_uci(move, ucistm, buf);
+    } else {
+        strcpy(buf, "0000");
+    }
+    pthread_mutex_lock(&ucilock);
+    while (uciinfinite && !ucistop)
+        pthread_cond_wait(&ucicond, &ucilock);
+    pthread_mutex_unlock(&ucilock);
+    fprintf(stdout, "bestmove %s\n", buf);
+    fflush(stdout);
+    return (NULL);
+}
+
+int uci(void)
+// UCI front end. Commands are read on this thread while the search runs
+// on another, so stop and isready are answered at once.
+{
+    static char line[1 << 16];
+    pthread_t thread;
+    int searching = 0;
+    char *tok;
+    char *save;
+    copy_board(*get_init(), uciboard);
+    score_board(uciboard);
+    ucistm = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        tok = strtok_r(line, " \t\r\n", &save);
+        if (!tok)
+            continue;
+        if (!strcmp(tok, "isready")) {
+            fprintf(stdout, "readyok\n");
+            fflush(stdout);
+            continue;
+        }
+        if (!strcmp(tok, "uci")) {
+            fprintf(stdout, "id name adzchess\n");
+            fprintf(stdout, "id author Antoniu Daniel Zapirtan\n");
+            fprintf(stdout, "option name Hash type spin default %u min 1 max 16384\n", \
+                (unsigned int) (((u6) 16 << _HASHBITS) >> 20));
+            fprintf(stdout, "option name Threads type spin default 1 min 1 max 1\n");
+            fprintf(stdout, "option name MultiPV type spin default 1 min 1 max %d\n", _MAXMULTIPV);
+            fprintf(stdout, "uciok\n");
+            fflush(stdout);
+            continue;
+        }
+        if (!strcmp(tok, "ponderhit")) {
+            // The ponder search becomes the real one, on the clock of its go
+            pthread_mutex_lock(&ucilock);
+            if (searching && uciponder) {
+                update(&ucigo);
+                if (ucibudget > 0)
+                    gdeadline = dclock(&ucigo) + ucibudget;
+                uciponder = 0;
+                uciinfinite = 0;
+                pthread_cond_broadcast(&ucicond);
+            }
+            pthread_mutex_unlock(&ucilock);
+            continue;
+        }
+        // Everything else stops the running search first
+        if (searching) {
+            pthread_mutex_lock(&ucilock);
+            ucistop = 1;
+            pthread_cond_broadcast(&ucicond);
+            pthread_mutex_unlock(&ucilock);
+            gabort = 1;
+            pthread_join(thread, NULL);
+            searching = 0;
+        }
+        if (!strcmp(tok, "quit")) {
+            break;
+        } else if (!strcmp(tok, "ucinewgame")) {
+            memset(hashtable, 0, (1 << ghashbits) * sizeof(HASHENTRY));
+        } else if (!strcmp(tok, "setoption")) {
+            char *name = NULL;
+            char *value = NULL;
+            while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+                if (!strcmp(tok, "name"))
+                    name = strtok_r(NULL, " \t\r\n", &save);
+                else if (!strcmp(tok, "value"))
+                    value = strtok_r(NULL, " \t\r\n", &save);
+            }
+            if (name && value && !strcasecmp(name, "Hash")) {
+                u6 entries = ((u6) atoi(value) << 20) / sizeof(HASHENTRY);
+                u5 bits = 10;
+                while (bits < 30 && ((u6) 2 << bits) <= entries)
+                    bits++;
+                hash_resize(bits);
+            } else if (name && value && !strcasecmp(name, "MultiPV")) {
+                gmultipv = atoi(value);
+                if (gmultipv < 1)
+                    gmultipv = 1;
+                if (gmultipv > _MAXMULTIPV)
+                    gmultipv = _MAXMULTIPV;
+            }
+        } else if (!strcmp(tok, "position")) {
+            BOARD next;
+            MOVE move;
+            char fen[256] = "";
+            tok = strtok_r(NULL, " \t\r\n", &save);
+            if (tok && !strcmp(tok, "fen")) {
+                while ((tok = strtok_r(NULL, " \t\r\n", &save)) && strcmp(tok, "moves")) {
+                    strncat(fen, tok, sizeof(fen) - strlen(fen) - 2);
+                    strcat(fen, " ");
+                }
+                if (!fen_board(fen, uciboard, &ucistm, NULL)) {
+                    fprintf(stdout, "info string bad fen\n");
+                    fflush(stdout);
+                    continue;
+                }
+                if (ucistm)
+                    transpose(uciboard);
+            } else {
+                copy_board(*get_init(), uciboard);
+                score_board(uciboard);
+                ucistm = 0;
+                tok = strtok_r(NULL, " \t\r\n", &save);
+            }
+            if (tok && !strcmp(tok, "moves"))
+            while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+                if (!uci_move(uciboard, ucistm, tok, move)) {
+                    fprintf(stdout, "info string illegal move %s\n", tok);
+                    fflush(stdout);
+                    break;
+                }
+                makemove(uciboard, move, next);
+                copy_board(next, uciboard);
+                ucistm = 1 - ucistm;
+            }
+        } else if (!strcmp(tok, "go")) {
+            double ms[2] = { 0, 0 };
+            double inc[2] = { 0, 0 };
+            double movetime = 0;
+            s5 movestogo = 0;
+            int ponder = 0;
+            gmaxdepth = 0;
+            gnodelimit = 0;
+            uciinfinite = 0;
+            while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+                char *arg;
+                if (!strcmp(tok, "infinite") || !strcmp(tok, "ponder")) {
+                    ponder = !strcmp(tok, "ponder");
+                    uciinfinite = 1;
+                    continue;
+                }
+                if (!(arg = strtok_r(NULL, " \t\r\n", &save)))
+                    break;
+                if (!strcmp(tok, "depth"))
+                    gmaxdepth = atoi(arg);
+                else if (!strcmp(tok, "nodes"))
+                    gnodelimit = strtoull(arg, NULL, 10);
+                else if (!strcmp(tok, "movetime"))
+                    movetime = atof(arg);
+                else if (!strcmp(tok, "wtime"))
+                    ms[0] = atof(arg);
+                else if (!strcmp(tok, "btime"))
+                    ms[1] = atof(arg);
+                else if (!strcmp(tok, "winc"))
+                    inc[0] = atof(arg);
+                else if (!strcmp(tok, "binc"))
+                    inc[1] = atof(arg);
+                else if (!strcmp(tok, "movestogo"))
+                    movestogo = atoi(arg);
+            }
+            // Seconds for this move; 0 means no time limit
+            if (movetime > 0)
+                gdeadline = movetime / 1000.0;
+            else if (ms[ucistm] > 0)
+                gdeadline = min(ms[ucistm] / 2, ms[ucistm] / (movestogo ? movestogo : 30) + 0.75 * inc[ucistm]) / 1000.0;
+            else
+                gdeadline = 0;
+            uciponder = ponder;
+            ucibudget = gdeadline;
+            if (uciinfinite)
+                gdeadline = 0;
+            stm = ucistm;
+            init(&elapsed);
+            init(&ucigo);
+            ucistop = 0;
+            gabort = 0;
+            if (pthread_create(&thread, NULL, uci_search, NULL)) {
+                warn("Cannot start search thread");
+                return (1);
+            }
+            searching = 1;
+        }
+    }
+    if (searching) {
+        pthread_mutex_lock(&ucilock);
+        ucistop = 1;
+        pthread_cond_broadcast(&ucicond);
+        pthread_mutex_unlock(&ucilock);
+        gabort = 1;
+        pthread_join(thread, NULL);
+    }
+    return (0);
+}
+
+SERVEJOB *servequeue; // Sorted by priority, then id
+SERVEJOB *serverunning;
+s5 servequeued;
+u6 serveids;
+u6 servejobs;
+NODES servenodes;
+double servetime;
+int servedone;
+int servesock = -1;
+pthread_mutex_t servelock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t servecond = PTHREAD_COND_INITIALIZER;
+
+void serve_send(s5 fd, const char *line)
+// Whole lines only, so the search and the client threads never interleave
+{
+    size_t n = strlen(line);
+    ssize_t r;
+    while (n > 0 && (r = write(fd, line, n)) > 0) {
+        line += r;
+        n -= r;
+    }
+}
+
+void serve_info(BOARD start, VALUE value, MOVE *line, LEVEL len, LEVEL depth, double delapsed)
+// Progress of the running job after each iteration, in the terms of UCI info
+{
+    char out[4096];
+    char buf[8];
+    char *p = out;
+    LEVEL i;
+    if (!serverunning)
+        return;
+    len = pv_length(start, line, len, value);
+    p += sprintf(p, "info %llu depth %u seldepth %u", serverunning->id, depth, gseldepth);
+    if (value > _THRESHOLD || value < -_THRESHOLD)
+        p += sprintf(p, " score mate %d", mate_moves(value));
+    else
+        p += sprintf(p, " score cp %d", value);
+    p += sprintf(p, " nodes %llu nps %u time %u pv", nodes, \
+        (unsigned int) ((double) nodes / (delapsed + !delapsed)), (unsigned int) (1000.0 * delapsed));
+    for (i = 0; i < len && p < out + sizeof(out) - 16; i++) {
+        move_uci(line[i], (stm + i) % 2, buf);
+        p += sprintf(p, " %s", buf);
+    }
+    sprintf(p, "\n");
+    // Under the lock, as the client thread replies on the same socket
+    pthread_mutex_lock(&servelock);
+    if (serverunning)
+        serve_send(serverunning->fd, out);
+    pthread_mutex_unlock(&servelock);
+}
+
+void *serve_search(void *arg)
+// The one search thread: takes the first job of the queue, searches it
+// with its limits or the daemon's, and answers with the result
+{
+    s5 depth = gmaxdepth;
+    NODES limit = gnodelimit;
+    double time = gtimelimit;
+    char line[256];
+    char san[16];
+    char uci[8];
+    MOVE move;
+    VALUE value;
+    SERVEJOB *job;
+    (void) arg;
+    while (1) {
+        pthread_mutex_lock(&servelock);
+        while (!servequeue && !servedone)
+            pthread_cond_wait(&servecond, &servelock);
+        if (servedone) {
+            pthread_mutex_unlock(&servelock);
+            break;
+        }
+        job = servequeue;
+        servequeue = job->next;
+        servequeued--;
+        serverunning = job;
+        gabort = 0;
+        pthread_mutex_unlock(&servelock);
+        gmaxdepth = job->depth ? job->depth : depth;
+        gnodelimit = job->nodes ? job->nodes : limit;
+        stm = job->side;
+        init(&elapsed);
+        gdeadline = (job->time > 0) ? job->time : time;
+        if (legal_moves(job->board, treea[0].legal_moves)) {
+            think(job->board, move, &value);
+            update(&elapsed);
+            move_san(job->board, job->side, move, san);
+            move_uci(move, job->side, uci);
+            snprintf(line, sizeof(line), "result %llu bm %s uci %s ce %d acd %u acn %llu acs %.2lf\n", \
+                job->id, san, uci, value, gcompleted, nodes, dclock(&elapsed));
+        } else {
+            update(&elapsed);
+            snprintf(line, sizeof(line), "result %llu error no legal moves\n", job->id);
+        }
+        pthread_mutex_lock(&servelock);
+        serve_send(job->fd, line);
+        servejobs++;
+        servenodes += nodes;
+        servetime += dclock(&elapsed);
+        serverunning = NULL;
+        pthread_cond_broadcast(&servecond);
+        pthread_mutex_unlock(&servelock);
+        free(job);
+    }
+    return (NULL);
+}
+
+int serve_job(s5 fd, char *args, char *reply)
+// "analyze [priority N] [depth N] [nodes N] [time S] fen FEN|pgn MOVETEXT".
+// The queued line is sent here, before the search thread can take the job
+// and answer it; `reply' is left empty then.
+{
+    SERVEJOB *job = (SERVEJOB *) calloc(1, sizeof(SERVEJOB));
+    SERVEJOB **q;
+    char *save;
+    char *tok;
+    char *arg;
+    if (!job) {
+        sprintf(reply, "error out of memory\n");
+        return (0);
+    }
+    job->fd = fd;
+    job->moveno = 1;
+    while ((tok = strtok_r(args, " \t\r\n", &save))) {
+        args = NULL;
+        if (!strcmp(tok, "fen") || !strcmp(tok, "pgn"))
+            break;
+        if (!(arg = strtok_r(NULL, " \t\r\n", &save)))
+            break;
+        if (!strcmp(tok, "priority"))
+            job->priority = atoi(arg);
+        else if (!strcmp(tok, "depth"))
+            job->depth = atoi(arg);
+        else if (!strcmp(tok, "nodes"))
+            job->nodes = strtoull(arg, NULL, 10);
+        else if (!strcmp(tok, "time"))
+            job->time = atof(arg);
+    }
+    if (tok && !strcmp(tok, "fen")) {
+        if (!fen_board(save, job->board, &job->side, &job->moveno)) {
+            sprintf(reply, "error bad fen\n");
+            free(job);
+            return (0);
+        }
+        if (job->side)
+            transpose(job->board);
+    } else if (tok && !strcmp(tok, "pgn")) {
+        PGNGAME *game = (PGNGAME *) malloc(sizeof(PGNGAME));
+        FILE *f = fmemopen(save, strlen(save), "r");
+        s5 r = (game && f) ? pgn_next(f, game) : 0;
+        if (f)
+            fclose(f);
+        if (r > 0) {
+            copy_board(game->board, job->board);
+            job->side = game->side;
+            job->moveno = game->moveno;
+        }
+        free(game);
+        if (r <= 0) {
+            sprintf(reply, "error bad pgn\n");
+            free(job);
+            return (0);
+        }
+    } else {
+        sprintf(reply, "error no position\n");
+        free(job);
+        return (0);
+    }
+    pthread_mutex_lock(&servelock);
+    job->id = ++serveids;
+    s5 ahead = 0;
+    for (q = &servequeue; *q && (*q)->priority >= job->priority; q = &(*q)->next)
+        ahead++;
+    job->next = *q;
+    *q = job;
+    servequeued++;
+    sprintf(reply, "queued %llu ahead %d\n", job->id, ahead + (serverunning != NULL));
+    serve_send(fd, reply);
+    reply[0] = 0;
+    pthread_cond_broadcast(&servecond);
+    pthread_mutex_unlock(&servelock);
+    return (1);
+}
+
+void *serve_client(void *arg)
+// One connection: jobs, stats, quit and shutdown, a command per line. Its
+// queued jobs are dropped and its running job is stopped when it closes.
+{
+    s5 fd = (s5) (intptr_t) arg;
+    FILE *in = fdopen(dup(fd), "r");
+    char *line = (char *) malloc(1 << 16);
+    char reply[256];
+    char *save;
+    char *tok;
+    SERVEJOB **q;
+    while (in && line && fgets(line, 1 << 16, in)) {
+        tok = strtok_r(line, " \t\r\n", &save);
+        if (!tok)
+            continue;
+        if (!strcmp(tok, "analyze")) {
+            serve_job(fd, save, reply);
+        } else if (!strcmp(tok, "stats")) {
+            pthread_mutex_lock(&servelock);
+            sprintf(reply, "stats queue %d running %llu jobs %llu nodes %llu nps %u hashfull %u\n", \
+                servequeued, serverunning ? serverunning->id : 0ULL, servejobs, servenodes, \
+                (unsigned int) ((double) servenodes / (servetime + !servetime)), hash_full());
+            pthread_mutex_unlock(&servelock);
+        } else if (!strcmp(tok, "quit")) {
+            break;
+        } else if (!strcmp(tok, "shutdown")) {
+            pthread_mutex_lock(&servelock);
+            servedone = 1;
+            gabort = 1;
+            pthread_cond_broadcast(&servecond);
+            pthread_mutex_unlock(&servelock);
+            shutdown(servesock, SHUT_RDWR);
+            break;
+        } else {
+            sprintf(reply, "error unknown command %.64s\n", tok);
+        }
+        if (!reply[0])
+            continue;
+        pthread_mutex_lock(&servelock);
+        serve_send(fd, reply);
+        pthread_mutex_unlock(&servelock);
+    }
+    if (in)
+        fclose(in);
+    free(line);
+    pthread_mutex_lock(&servelock);
+    for (q = &servequeue; *q; ) {
+        SERVEJOB *job = *q;
+        if (job->fd == fd) {
+            *q = job->next;
+            servequeued--;
+            free(job);
+        } else {
+            q = &job->next;
+        }
+    }
+    if (serverunning && serverunning->fd == fd)
+        gabort = 1;
+    while (serverunning && serverunning->fd == fd)
+        pthread_cond_wait(&servecond, &servelock);
+    pthread_mutex_unlock(&servelock);
+    close(fd);
+    return (NULL);
+}
+
+int serve(const char *path)
+// Analysis daemon on a Unix-domain socket, e.g. `socat - UNIX-CONNECT:path'.
+// Jobs of every connection share one queue, one search thread and one
+// hash table, which stays warm from job to job.
+{
+    struct sockaddr_un addr;
+    pthread_t search;
+    pthread_t client;
+    s5 fd;
+    signal(SIGPIPE, SIG_IGN);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        warn("Socket path too long");
+        return (1);
+    }
+    strcpy(addr.sun_path, path);
+    servesock = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (servesock < 0 || bind(servesock, (struct sockaddr *) &addr, sizeof(addr)) || listen(servesock, 16)) {
+        warn("Cannot listen on socket");
+        return (1);
+    }
+    if (pthread_create(&search, NULL, serve_search, NULL)) {
+        warn("Cannot start search thread");
+        return (1);
+    }
+    while ((fd = accept(servesock, NULL, NULL)) >= 0 || errno == EINTR) {
+        if (fd < 0)
+            continue;
+        if (pthread_create(&client, NULL, serve_client, (void *) (intptr_t) fd)) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(client);
+    }
+    pthread_mutex_lock(&servelock);
+    servedone = 1;
+    gabort = 1;
+    pthread_cond_broadcast(&servecond);
+    pthread_mutex_unlock(&servelock);
+    pthread_join(search, NULL);
+    close(servesock);
+    unlink(path);
+    return (0);
+}
+
+s5 spsa_game(s5 *plus, s5 *minus, u6 seed, s5 plus_white)
+// One fixed-node game; returns 2, 1 or 0 for a win, draw or loss of `plus'.
+// Each side gets its own hash table so that neither reads the other's scores.
+{
+    BOARD board;
+    BOARD next;
+    MOVELIST movelist;
+    MOVEINDEX n;
+    MOVEINDEX i;
+    MOVE move;
+    VALUE value;
+    HASHENTRY *tables[2];
+    s5 side = 0;
+    s5 ply;
+    s5 lost[2] = { 0, 0 };
+    u5 p;
+    copy_board(*get_init(), board);
+    score_board(board);
+    if (bookfile) {
+        FILE *f = fopen(bookfile, "r");
+        char line[256];
+        u6 count = 0;
+        u6 pick;
+        if (!f) {
+            warn("Cannot open book file");
+            exit(1);
+        }
+        while (fgets(line, sizeof(line), f))
+            count++;
+        pick = count ? hash_rand(&seed) % count : 0;
+        rewind(f);
+        for (count = 0; fgets(line, sizeof(line), f); count++)
+        if (count == pick) {
+            if (fen_board(line, board, &side, NULL) && side)
+                transpose(board);
+            break;
+        }
+        fclose(f);
+    } else {
+        for (ply = 0; ply < _SPSA_RANDOM; ply++) {
+            n = legal_moves(board, movelist);
+            if (!n)
+                break;
+            makemove(board, movelist[hash_rand(&seed) % n], next);
+            copy_board(next, board);
+            side = 1 - side;
+        }
+    }
+    tables[0] = hashtable;
+    tables[1] = (HASHENTRY *) calloc(1 << ghashbits, sizeof(HASHENTRY));
+    if (!tables[1]) {
+        warn("Out of memory");
+        exit(1);
+    }
+    memset(tables[0], 0, (1 << ghashbits) * sizeof(HASHENTRY));
+    for (ply = 0; ply < _SPSA_PLIES; ply++) {
+        // 0 if `plus' is to move
+        s5 who = (side == 0) != (plus_white != 0);
+        n = legal_moves(board, movelist);
+        if (!n) {
+            if (!in_check(board))
+                return (1);
+            return (who ? 2 : 0);
+        }
+        for (p = 0; p < _NSPARAMS; p++)
+            *sparams[p].value = who ? minus[p] : plus[p];
+        hashtable = tables[who];
+        stm = side;
+        s5 done = think(board, move, &value);
+        for (i = 0; i < n; i++)
+        if (!move_cmp(move, movelist[i]))
+            break;
+        if (i == n)
+            copy_move(movelist[0], move);
+        lost[who] = (done && value < -_SPSA_RESIGN) ? lost[who] + 1 : 0;
+        if (lost[who] >= 4 && lost[1 - who] == 0)
+            return (who ? 2 : 0);
+        makemove(board, move, next);
+        copy_board(next, board);
+        side = 1 - side;
+    }
+    return (1);
+}
+
+void data_pack(BOARD board, s5 side, s5 moveno, VALUE value, DATAPOS *pos)
+// The record is stored from White's side: the board turned with White at
+// the bottom, the score for White, and the side to move in `side'
+{
+    BOARD aux;
+    u5 n = 0;
+    u5 y;
+    u5 x;
+    copy_board(board, aux);
+    if (side)
+        transpose(aux);
+    memset(pos, 0, sizeof(*pos));
+    for (y = 0; y < 8; y++)
+    for (x = 0; x < 8; x++)
+    if (aux[y][x]) {
+        pos->occupied |= 1ULL << (y * 8 + x);
+        pos->pieces[n >> 1] |= (aux[y][x] + 6) << ((n & 1) << 2);
+        n++;
+    }
+    pos->score = side ? -value : value;
+    pos->side = side;
+    pos->castle = (aux[8][0] != 0) | ((aux[8][1] != 0) << 1) | ((aux[8][2] != 0) << 2) | ((aux[8][3] != 0) << 3) | \
+        (STATE(aux)->ep << 4);
+    pos->halfmove = STATE(aux)->halfmove;
+    pos->moveno = moveno;
+}
+
+void data_unpack(DATAPOS *pos, BOARD board)
+// Back to a board with the side to move at the bottom
+{
+    u5 n = 0;
+    u5 sq;
+    memset(board, 0, sizeof(BOARD));
+    for (sq = 0; sq < 64; sq++)
+    if (pos->occupied & (1ULL << sq)) {
+        board[sq >> 3][sq & 7] = ((pos->pieces[n >> 1] >> ((n & 1) << 2)) & 15) - 6;
+        n++;
+    }
+    for (sq = 0; sq < 4; sq++)
+        board[8][sq] = (pos->castle >> sq) & 1;
+    score_board(board);
+    STATE(board)->ep = pos->castle >> 4;
+    STATE(board)->halfmove = pos->halfmove;
+    if (pos->side)
+        transpose(board);
+}
+
+s5 data_keep(BOARD board, s5 ply, VALUE value)
+// Sampled positions: out of the opening, not in check, searched to
+// _DATAGEN_DEPTH, not a mate score
+{
+    return (ply >= _DATAGEN_SKIP && !in_check(board) && gcompleted >= _DATAGEN_DEPTH && \
+        value <= _THRESHOLD && value >= -_THRESHOLD);
+}
+
+void data_write(s5 fd, DATAPOS *pos, s5 n, s5 result)
+// One game in one write(): O_APPEND keeps the games of several processes whole
+{
+    size_t len = n * sizeof(DATAPOS);
+    char *p = (char *) pos;
+    ssize_t r;
+    s5 i;
+    for (i = 0; i < n; i++)
+        pos[i].result = result;
+    while (len > 0 && (r = write(fd, p, len)) > 0) {
+        p += r;
+        len -= r;
+    }
+}
+
+s5 datagen_game(s5 fd, u6 seed)
+// One fixed-node self-play game from a random or book opening; the same
+// table serves both sides
+{
+    BOARD board;
+    BOARD next;
+    MOVELIST movelist;
+    MOVEINDEX n;
+    MOVEINDEX i;
+    MOVE move;
+    VALUE value;
+    DATAPOS *pos = (DATAPOS *) malloc(_DATAGEN_PLIES * sizeof(DATAPOS));
+    s5 npos = 0;
+    s5 side = 0;
+    s5 moveno = 1;
+    s5 ply;
+    s5 lost[2] = { 0, 0 };
+    s5 result = 1;
+    if (!pos)
+        return (1);
+    copy_board(*get_init(), board);
+    score_board(board);
+    if (bookfile) {
+        FILE *f = fopen(bookfile, "r");
+        char line[256];
+        u6 count = 0;
+        u6 pick;
+        if (!f) {
+            warn("Cannot open book file");
+            free(pos);
+            return (1);
+        }
+        while (fgets(line, sizeof(line), f))
+            count++;
+        pick = count ? hash_rand(&seed) % count : 0;
+        rewind(f);
+        for (count = 0; fgets(line, sizeof(line), f); count++)
+        if (count == pick) {
+            if (fen_board(line, board, &side, &moveno) && side)
+                transpose(board);
+            break;
+        }
+        fclose(f);
+    } else {
+        for (ply = 0; ply < _DATAGEN_RANDOM; ply++) {
+            n = legal_moves(board, movelist);
+            if (!n)
+                break;
+            makemove(board, movelist[hash_rand(&seed) % n], next);
+            copy_board(next, board);
+            moveno += side;
+            side = 1 - side;
+        }
+    }
+    memset(hashtable, 0, (1 << ghashbits) * sizeof(HASHENTRY));
+    for (ply = 0; ply < _DATAGEN_PLIES; ply++) {
+        n = legal_moves(board, movelist);
+        if (!n) {
+            result = in_check(board) ? (side ? 2 : 0) : 1;
+            break;
+        }
+        if (STATE(board)->halfmove >= 100)
+            break;
+        stm = side;
+        s5 done = think(board, move, &value);
+        for (i = 0; i < n; i++)
+        if (!move_cmp(move, movelist[i]))
+            break;
+        if (i == n)
+            copy_move(movelist[0], move);
+        if (data_keep(board, ply + _DATAGEN_RANDOM, value))
+            data_pack(board, side, moveno, value, &pos[npos++]);
+        lost[side] = (done && value < -_SPSA_RESIGN) ? lost[side] + 1 : 0;
+        if (lost[side] >= 4 && lost[1 - side] == 0) {
+            result = side ? 2 : 0;
+            break;
+        }
+        makemove(board, move, next);
+        copy_board(next, board);
+        moveno += side;
+        side = 1 - side;
+    }
+    data_write(fd, pos, npos, result);
+    free(pos);
+    return (0);
+}
+
+s5 datagen_pgn(s5 fd, PGNGAME *game)
+// The sampled positions of a finished game, scored by fixed-node searches
+{
+    BOARD board;
+    BOARD next;
+    MOVE move;
+    VALUE value;
+    DATAPOS *pos = (DATAPOS *) malloc((game->plies + 1) * sizeof(DATAPOS));
+    s5 result = !strcmp(game->result, "1-0") ? 2 : !strcmp(game->result, "0-1") ? 0 : 1;
+    s5 side = game->start_side;
+    s5 moveno = game->start_moveno;
+    s5 npos = 0;
+    s5 ply;
+    if (!pos)
+        return (1);
+    memset(hashtable, 0, (1 << ghashbits) * sizeof(HASHENTRY));
+    copy_board(game->start, board);
+    for (ply = 0; ply < game->plies; ply++) {
+        if (legal_moves(board, treea[0].legal_moves)) {
+            stm = side;
+            think(board, move, &value);
+            if (data_keep(board, ply, value))
+                data_pack(board, side, moveno, value, &pos[npos++]);
+        }
+        makemove(board, game->moves[ply], next);
+        copy_board(next, board);
+        moveno += side;
+        side = 1 - side;
+    }
+    data_write(fd, pos, npos, result);
+    free(pos);
+    return (0);
+}
+
+int datagen(const char *name, char **pgns, s5 npgns)
+// Training positions appended to `name' as DATAPOS records: from --games
+// self-play games, or from the finished games of PGN files when any are
+// given. As in spsa, each game is played or scored in a process of its
+// own, --threads of them at a time, at --nodes per position.
+{
+    PGNGAME *game = (PGNGAME *) malloc(sizeof(PGNGAME));
+    FILE *f = NULL;
+    struct stat st;
+    off_t size0 = 0;
+    s5 n = gthreads;
+    s5 games = ggames;
+    s5 started = 0;
+    s5 running = 0;
+    s5 k = 0;
+    s5 r;
+    u6 seed = (u6) time(NULL) * 0x9e3779b97f4a7c15ULL;
+    time_t t0 = time(NULL);
+    s5 fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || !game) {
+        warn("Cannot open data file");
+        return (1);
+    }
+    if (!fstat(fd, &st))
+        size0 = st.st_size;
+    if (n < 1)
+        n = (s5) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (games < 1)
+        games = 2 * n;
+    if (!gnodelimit)
+        gnodelimit = _DATAGEN_NODES;
+    gdeadline = 0;
+    while (1) {
+        if (running < n) {
+            if (npgns) {
+                // Next finished game of the files
+                r = 0;
+                while (k < npgns) {
+                    if (!f && !(f = fopen(pgns[k], "r"))) {
+                        warn("Cannot open .pgn file");
+                        k++;
+                        continue;
+                    }
+                    r = pgn_next(f, game);
+                    if (r > 0 && strcmp(game->result, "*"))
+                        break;
+                    if (!r) {
+                        fclose(f);
+                        f = NULL;
+                        k++;
+                    }
+                    r = 0;
+                }
+                if (!r && !running)
+                    break;
+            } else {
+                r = (started < games);
+                if (!r && !running)
+                    break;
+            }
+            if (r) {
+                pid_t pid = fork();
+                if (pid == 0)
+                    _exit(npgns ? datagen_pgn(fd, game) : datagen_game(fd, seed + started));
+                if (pid < 0) {
+                    warn("Cannot fork");
+                    return (1);
+                }
+                started++;
+                running++;
+                continue;
+            }
+        }
+        int status;
+        if (wait(&status) > 0)
+            running--;
+    }
+    free(game);
+    if (!fstat(fd, &st))
+        fprintf(stdout, "Games: %d, positions: %llu, %ld s\n", started, \
+            (u6) (st.st_size - size0) / sizeof(DATAPOS), (long) (time(NULL) - t0));
+    close(fd);
+    return (0);
+}
+
+int datadump(const char *name)
+// DATAPOS records as text, FEN, result and score per line: the EPD form
+// that tune reads
+{
+    char fen[128];
+    BOARD board;
+    struct stat st;
+    DATAPOS *pos;
+    u6 count;
+    u6 i;
+    s5 fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        warn("Cannot open data file");
+        return (1);
+    }
+    count = st.st_size / sizeof(DATAPOS);
+    if (!count) {
+        close(fd);
+        return (0);
+    }
+    pos = (DATAPOS *) mmap(NULL, count * sizeof(DATAPOS), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pos == MAP_FAILED) {
+        warn("Cannot map data file");
+        return (1);
+    }
+    for (i = 0; i < count; i++) {
+        data_unpack(&pos[i], board);
+        board_fen(board, pos[i].side, pos[i].moveno, fen);
+        fprintf(stdout, "%s [%.1lf] %d\n", fen, 0.5 * pos[i].result, pos[i].score);
+    }
+    munmap(pos, count * sizeof(DATAPOS));
+    return (0);
+}
+
+int spsa(void)
+// SPSA over the search parameters: each iteration plays --games pairs of
+// fixed-node games between theta + c*delta and theta - c*delta, one game
+// per process and --threads processes at a time, then moves theta by the
+// score. Results go to --out after every iteration.
+{
+    double theta[_NSPARAMS];
+    double c[_NSPARAMS];
+    double a[_NSPARAMS];
+    s5 plus[_NSPARAMS];
+    s5 minus[_NSPARAMS];
+    s5 delta[_NSPARAMS];
+    s5 iterations = giterations ? giterations : _SPSA_ITER;
+    s5 games;
+    s5 n = gthreads;
+    s5 k;
+    s5 running;
+    s5 started;
+    s5 score;
+    u5 p;
+    u6 seed = (u6) time(NULL) * 0x9e3779b97f4a7c15ULL;
+    time_t t0 = time(NULL);
+    if (n < 1)
+        n = (s5) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    games = 2 * (ggames > 0 ? ggames : n);
+    if (!gnodelimit)
+        gnodelimit = _SPSA_NODES;
+    for (p = 0; p < _NSPARAMS; p++) {
+        theta[p] = *sparams[p].value;
+        c[p] = (sparams[p].hi - sparams[p].lo) / 10.0;
+        if (c[p] < 1)
+            c[p] = 1;
+        a[p] = c[p] * c[p] / 2;
+    }
+    for (k = 1; k <= iterations; k++) {
+        double ck = 1.0 / pow(k, 0.101);
+        double ak = pow(1.0 + iterations / 10.0, 0.602) / pow(k + iterations / 10.0, 0.602);
+        for (p = 0; p < _NSPARAMS; p++) {
+            delta[p] = (hash_rand(&seed) & 1) ? 1 : -1;
+            plus[p] = (s5) lround(theta[p] + ck * c[p] * delta[p]);
+            minus[p] = (s5) lround(theta[p] - ck * c[p] * delta[p]);
+            if (plus[p] < sparams[p].lo) plus[p] = sparams[p].lo;
+            if (plus[p] > sparams[p].hi) plus[p] = sparams[p].hi;
+            if (minus[p] < sparams[p].lo) minus[p] = sparams[p].lo;
+            if (minus[p] > sparams[p].hi) minus[p] = sparams[p].hi;
+        }
+        u6 round = hash_rand(&seed);
+        score = 0;
+        running = 0;
+        started = 0;
+        while (started < games || running) {
+            if (started < games && running < n) {
+                // Both games of a pair start from the same opening
+                pid_t pid = fork();
+                if (pid == 0)
+                    _exit(spsa_game(plus, minus, round + started / 2, started & 1));
+                if (pid < 0) {
+                    warn("Cannot fork");
+                    return (1);
+                }
+                started++;
+                running++;
+                continue;
+            }
+            int status;
+            if (wait(&status) > 0) {
+                running--;
+                if (WIFEXITED(status))
+                    score += WEXITSTATUS(status) - 1;
+            }
+        }
+        for (p = 0; p < _NSPARAMS; p++) {
+            theta[p] += ak * a[p] * score / (games * ck * c[p] * delta[p]);
+            if (theta[p] < sparams[p].lo) theta[p] = sparams[p].lo;
+            if (theta[p] > sparams[p].hi) theta[p] = sparams[p].hi;
+            *sparams[p].value = (s5) lround(theta[p]);
+        }
+        fprintf(stdout, "Iteration %d: score %+d of %d, %ld s\n", k, score, games, (long) (time(NULL) - t0));
+        for (p = 0; p < _NSPARAMS; p++)
+            fprintf(stdout, "%s %.2lf\n", sparams[p].name, theta[p]);
+        fprintf(stdout, "\n");
+        fflush(stdout);
+        save_params(outfile ? outfile : "spsa.bpf");
+    }
+    return (0);
 }
@@ -1,22 +1,14 @@
 #! /usr/bin/bash
 
-_CHESS960=0
+# One binary for every workflow: input, window and depth are runtime
+# options (--fen, --pgn, --window, --max-depth, --chess960, --json)
 SOURCE=adzchess.c
-: ${gamesymbol:=ini}
-
-if [ x"$_ICCF" = x1 ]; then
-  SOURCE=ctpk.c
-fi
 
 gcc -o adzchess \
     $SOURCE \
     -lm \
+    -lpthread \
     -O3 \
     -march=native \
     -w \
-    -D$gamesymbol=1 \
-    -D_OPTIMIZE=1 \
-    -D_ICCF=$_ICCF \
-    -D_CHESS960=$_CHESS960 \
-    -D_NOEDIT=$_NOEDIT || exit 3
-
+    -D_OPTIMIZE=1 || exit 3
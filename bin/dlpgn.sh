@@ -1,6 +1,7 @@
 #! /bin/bash
 
 GN=$1
+FEN=${2:-start.fen}
 
 USERNAME=antoniudanielzapirtan
 url1="https://api.chess.com/pub/player/$USERNAME/games/to-move"
@@ -21,7 +22,7 @@ while true; do
 	myurlc=$(jq -c .games[$n].url /tmp/games.txt)
 	if [ x"$myurl" = x"$myurlc" ]; then
 		fen=$(jq -r .games[$n].fen /tmp/games.txt)
-		echo $fen >start.fen
+		echo $fen >$FEN
 		jq -c .games[$n].white /tmp/games.txt
 		jq -c .games[$n].black /tmp/games.txt
 		jq -c .games[$n].rules /tmp/games.txt
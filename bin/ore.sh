@@ -1,13 +1,21 @@
 #! /bin/bash
 
+# Moves played after a move sequence, with their game counts, from the
+# position database; transpositions count too. The database is rebuilt
+# when the PGN file is newer.
 PGNFILE=base/sea.pgn
+DBFILE=base/sea.db
 var="$1"
 
-movelist=$(cat $PGNFILE \
-  | grep -o "$var [^ ]\+" \
-  | sort -u | awk '{print $NF}')
+if [ ! -f $DBFILE -o $PGNFILE -nt $DBFILE ]; then
+  ./adzchess dbbuild $DBFILE $PGNFILE >&2 || exit 1
+fi
 
-for move in $movelist; do
-  echo -n "$move "
-  cat $PGNFILE | grep "$var $move "|wc -l
-done|sort -nk 2
+tmp=$(mktemp)
+echo "$var *" > $tmp
+fen=$(./adzchess --pgn $tmp --print-fen)
+rm -f $tmp
+
+./adzchess dbquery "$fen" --db $DBFILE \
+  | grep -v '^Entries:' \
+  | awk '{print $1, $2}' | sort -nk 2
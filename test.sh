@@ -1,5 +1,5 @@
 #! /bin/bash
 
-_ICCF=1 _CHESS960=0 _NOEDIT=1 bash bin/build.sh
+bash bin/build.sh
 sudo install -m 0755 adzchess /usr/local/bin
-(adzchess &>anl/$(date +%y%m%d-%H%M).anl &)
+(adzchess --pgn start.pgn --window 50 &>anl/$(date +%y%m%d-%H%M).anl &)